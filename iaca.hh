@@ -31,10 +31,22 @@
 #include <exception>
 #include <algorithm>
 #include <functional>
+#include <list>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 
 
 #include <QApplication>
+#include <QAbstractItemModel>
+#include <QCache>
 #include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QTreeView>
 #include <QHash>
 #include <QString>
 #include <QChar>
@@ -47,12 +59,14 @@ extern "C" const char iaca_timestamp[]; /// human readable timestamp
 extern "C" long long iaca_timeclock; // time from Unix Epoch (Jan 1, 1970)
 extern "C" const char iaca_lastgitcommit[];
 extern "C" const char iaca_lastgittag[];
+extern "C" const char iaca_headerhash[]; // SHA-256 of this iaca.hh, in hexadecimal
 
 namespace Iaca {
 // forward declarations
 class Value;
 class Payload;
 class ItemVal;
+class Transaction;
 
 enum class ValKind :uint8_t {
     Nil,
@@ -63,11 +77,129 @@ enum class ValKind :uint8_t {
     Tuple,
     Set,
 };
+constexpr const unsigned nb_val_kinds = 7;
 
 extern bool batch;
 
+/// low overhead statistics: per-thread counters bumped by the value
+/// constructors and destructors, and a census walking every item
+class Stats {
+public:
+    struct Counters {
+        std::atomic<long> _nbmade[nb_val_kinds];
+        std::atomic<long> _nbfreed[nb_val_kinds];
+        std::atomic<long> _bytesmade[nb_val_kinds];
+        std::atomic<long> _bytesfreed[nb_val_kinds];
+    };
+private:
+    static thread_local Counters* _curcounters_;
+    // every thread's counters, kept after the thread ends
+    static std::vector<Counters*> _allcounters_;
+    static std::mutex _statmtx_;
+    static std::condition_variable _statcond_;
+    static std::thread _periodic_thread_;
+    static bool _periodic_stop_;
+    static Counters* register_counters(void);
+    // only the owner thread writes its counters, so a plain load and
+    // store is enough, without a locked read-modify-write
+    static void bump(std::atomic<long>&counter, long delta) {
+        counter.store(counter.load(std::memory_order_relaxed)+delta,std::memory_order_relaxed);
+    };
+public:
+    static Counters& counters(void) {
+        if (!_curcounters_) _curcounters_ = register_counters();
+        return *_curcounters_;
+    };
+    static void count_make(ValKind k, size_t bytes) {
+        Counters&c = counters();
+        bump(c._nbmade[(unsigned)k],1);
+        bump(c._bytesmade[(unsigned)k],bytes);
+    };
+    static void count_free(ValKind k, size_t bytes) {
+        Counters&c = counters();
+        bump(c._nbfreed[(unsigned)k],1);
+        bump(c._bytesfreed[(unsigned)k],bytes);
+    };
+    static const char*kind_name(ValKind k);
+    /// the counters summed over all threads
+    static Json::Value counters_json(void);
+    /// walk every item: bytes per kind, size histograms, attribute fan-out
+    static Json::Value census_json(void);
+    /// write the counters as a JSON line to stderr every few seconds
+    static void start_periodic(unsigned secs);
+    static void stop_periodic(void);
+};
+
+/// scoped hot-path timers, recorded in a per-thread ring buffer written
+/// only by its thread, and exported as Chrome trace events or as folded
+/// stacks for flamegraphs. Without IACA_TRACING the scopes vanish.
+class Trace {
+    struct Event {
+        const char*_ename;
+        uint64_t _estart;	// nanoseconds
+        uint64_t _edur;
+    };
+    static constexpr const unsigned ring_size = 1<<16;
+    struct Ring {
+        Event _revents[ring_size];
+        std::atomic<uint64_t> _rhead;	// number of events ever recorded
+        unsigned _rtid;
+    };
+    static thread_local Ring* _curring_;
+    static std::vector<Ring*> _allrings_;
+    static std::mutex _trmtx_;
+    static std::atomic<bool> _enabled_;
+    static Ring* register_ring(void);
+    /// the recorded events of every thread, sorted by start
+    static std::vector<std::pair<unsigned,Event>> snapshot(void);
+public:
+    static bool enabled(void) {
+        return _enabled_.load(std::memory_order_relaxed);
+    };
+    static void enable(bool on) {
+        _enabled_.store(on);
+    };
+    static uint64_t now_ns(void) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>
+               (std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    static void record(const char*name, uint64_t start, uint64_t dur) {
+        if (!_curring_) _curring_ = register_ring();
+        uint64_t h = _curring_->_rhead.load(std::memory_order_relaxed);
+        Event&ev = _curring_->_revents[h % ring_size];
+        ev._ename = name;
+        ev._estart = start;
+        ev._edur = dur;
+        _curring_->_rhead.store(h+1,std::memory_order_release);
+    };
+    static void write_chrome_trace(std::ostream&out);
+    static void write_folded_stacks(std::ostream&out);
+    class Scope {
+        const char*const _sname;
+        const uint64_t _sstart;
+    public:
+        Scope(const char*name)
+            : _sname(name), _sstart(enabled()?now_ns():0) {};
+        ~Scope() {
+            if (_sstart) record(_sname,_sstart,now_ns()-_sstart);
+        };
+    };
+};
+
+#ifdef IACA_TRACING
+#define IACA_TRACE_SCOPE_AT(Name,Lin) Iaca::Trace::Scope iaca_trace_scope_##Lin(Name)
+#define IACA_TRACE_SCOPE_LINE(Name,Lin) IACA_TRACE_SCOPE_AT(Name,Lin)
+#define IACA_TRACE_SCOPE(Name) IACA_TRACE_SCOPE_LINE(Name,__LINE__)
+#else
+#define IACA_TRACE_SCOPE(Name) do {} while(0)
+#endif
+
 struct ItemPtr : public std::shared_ptr<ItemVal> {
+    using std::shared_ptr<ItemVal>::shared_ptr;
+    ItemPtr() = default;
+    ItemPtr(const std::shared_ptr<ItemVal>&sp) : std::shared_ptr<ItemVal>(sp) {};
     inline Json::Value to_json(void) const;
+    static ItemPtr from_json(const Json::Value&);
     inline void scan_items(std::function<bool(ItemVal*)>) ;
     static inline bool same(const ItemPtr ip1, const ItemPtr ip2)
     {
@@ -86,7 +218,11 @@ struct ItemPtr : public std::shared_ptr<ItemVal> {
 };
 
 struct ValuePtr : public std::shared_ptr<Value> {
+    using std::shared_ptr<Value>::shared_ptr;
+    ValuePtr() = default;
+    ValuePtr(const std::shared_ptr<Value>&sp) : std::shared_ptr<Value>(sp) {};
     inline Json::Value to_json(void) const;
+    static ValuePtr from_json(const Json::Value&);
     inline ValKind kind(void) const;
     inline void scan_items(std::function<bool(ItemVal*)>) ;
     static bool same(const ValuePtr vp1, const ValuePtr vp2);
@@ -148,8 +284,12 @@ public:
         if (!i2) return false;
         return i1->_ival < i2->_ival;
     };
-    IntVal(intptr_t i=0): _ival(i) {};
-    virtual ~IntVal() {  };
+    IntVal(intptr_t i=0): _ival(i) {
+        Stats::count_make(ValKind::Int,sizeof(IntVal));
+    };
+    virtual ~IntVal() {
+        Stats::count_free(ValKind::Int,sizeof(IntVal));
+    };
 };				// end class IntVal
 template<>
 inline bool Value::same_val<IntVal> (const IntVal*i1, const IntVal*i2)
@@ -172,8 +312,12 @@ public:
     double val() const {
         return _dval;
     };
-    DblVal(double d=0): _dval(d) {};
-    virtual ~DblVal() {  };
+    DblVal(double d=0): _dval(d) {
+        Stats::count_make(ValKind::Dbl,sizeof(DblVal));
+    };
+    virtual ~DblVal() {
+        Stats::count_free(ValKind::Dbl,sizeof(DblVal));
+    };
     virtual uint hash(void) const {
         uint h = qHash(_dval);
         if (!h) h = 317;
@@ -236,12 +380,21 @@ public:
     StrVal(const QString&qs)
         : _sval(qs),
           _scat(category(qs)),
-          _shash(hash_qstring(qs)) {};
+          _shash(hash_qstring(qs)) {
+        Stats::count_make(ValKind::Str,bytes());
+    };
     StrVal(const std::string& s)
         : _sval(s.c_str()),
           _scat(category(s.c_str())),
-          _shash(hash_qstring(_sval)) {};
-    ~StrVal() {};
+          _shash(hash_qstring(_sval)) {
+        Stats::count_make(ValKind::Str,bytes());
+    };
+    ~StrVal() {
+        Stats::count_free(ValKind::Str,bytes());
+    };
+    size_t bytes(void) const {
+        return sizeof(StrVal) + _sval.size()*sizeof(QChar);
+    };
     StrCategory category(void) const {
         return _scat;
     };
@@ -291,6 +444,7 @@ inline bool Value::less_val<StrVal>(const StrVal*s1, const StrVal*s2)
 
 
 class SeqItemsVal : public Value {
+public:
     static uint hash_itemsarr( ItemVal* arr[], unsigned siz, unsigned seed=0);
 protected:
     const uint _shash;
@@ -327,6 +481,9 @@ public:
     unsigned size() const {
         return _slen;
     };
+    size_t bytes(void) const {
+        return sizeof(SeqItemsVal) + _slen*sizeof(ItemVal*);
+    };
     ItemVal* unsafe_at(unsigned ix) const {
         return _sarr[ix];
     };
@@ -335,14 +492,18 @@ public:
 class TupleVal : public SeqItemsVal {
     static constexpr const unsigned seed = 431;
     TupleVal( ItemVal*arr[], unsigned siz)
-        : SeqItemsVal(arr,siz,seed) {};
+        : SeqItemsVal(arr,siz,seed) {
+        Stats::count_make(ValKind::Tuple,bytes());
+    };
     // the item pointers below are never null
     static const TupleVal*make_it(std::vector<ItemVal*>vecptr);
     static const TupleVal*make_it(ItemVal**arr, unsigned siz);
 public:
     static void add(std::vector<ItemVal*>&vec, ValuePtr val);
     static void add(std::vector<ItemVal*>&vec, ItemPtr val);
-    virtual ~TupleVal() {};
+    virtual ~TupleVal() {
+        Stats::count_free(ValKind::Tuple,bytes());
+    };
     virtual ValKind kind() const {
         return ValKind::Tuple;
     };
@@ -378,12 +539,16 @@ inline bool Value::less_val<TupleVal>(const TupleVal*tu1, const TupleVal*tu2)
 class SetVal : public SeqItemsVal {
     static constexpr const unsigned seed = 541;
     SetVal( ItemVal*arr[], unsigned siz)
-        : SeqItemsVal(arr,siz,seed) {};
+        : SeqItemsVal(arr,siz,seed) {
+        Stats::count_make(ValKind::Set,bytes());
+    };
     static const SetVal*make_it(std::vector<ItemVal*>vecptr);
     static const SetVal*make_it(std::set<ItemPtr>vecptr);
     static const SetVal*make_it(ItemVal**arr, unsigned siz);
-    virtual ~SetVal() {};
 public:
+    virtual ~SetVal() {
+        Stats::count_free(ValKind::Set,bytes());
+    };
     virtual ValKind kind() const {
         return ValKind::Set;
     };
@@ -420,20 +585,101 @@ inline bool Value::less_val<SetVal>(const SetVal*tu1, const SetVal*tu2)
 class Payload {
     ItemVal* _owneritem;
 public:
+    Payload(ItemVal*own=nullptr) : _owneritem(own) {};
+    ItemVal* owner(void) const {
+        return _owneritem;
+    };
     virtual ~Payload() {
         _owneritem = nullptr;
     };
 };
 
+/// how the attributes of an item are kept, see Pager
+enum class PageState :uint8_t {
+    Resident,			// not managed by the pager
+    PagedIn,			// in memory, may be evicted
+    PagedOut,			// only in the page store
+};
+
+/// the optional paged item mode: items stay as resident stubs (radix,
+/// rank, hash, payload) while their attributes are faulted in from a
+/// page store in JSON lines dump format on first access. An evictor
+/// thread writes back dirty items at the end of the store and evicts
+/// cold ones with the CLOCK policy to stay within a memory budget.
+class Pager {
+    static std::atomic<bool> _pgopen_;
+    static std::mutex _pgmtx_;
+    static std::condition_variable _pgcond_;
+    static std::fstream _pgstore_;
+    static std::string _pgpath_;
+    static size_t _pgbudget_;
+    static size_t _pgresident_;	// estimated bytes of paged in attributes
+    static std::vector<ItemVal*> _pgclock_;
+    static size_t _pghand_;
+    static std::thread _pgevictor_;
+    static bool _pgstop_;
+    static unsigned long _pgfaults_, _pgevictions_, _pgwrites_;
+    static unsigned long _pgwriteerrors_;
+    static std::string _pglasterror_;	// of the evictor
+    static void touch_slow(const ItemVal*itm);
+    static void resized_slow(const ItemVal*itm, long delta);
+    static void evict_loop(void);
+    static bool evict_one(void);
+    static void write_back(ItemVal*itm);
+    static size_t estimate_bytes(const ItemVal*itm);
+public:
+    static bool is_open(void) {
+        return _pgopen_.load(std::memory_order_relaxed);
+    };
+    /// called with the item locked, before any access to its attributes
+    static void touch(const ItemVal*itm) {
+        if (is_open()) touch_slow(itm);
+    };
+    /// estimated bytes of an attribute with that value, 0 for nil
+    static size_t attr_bytes(const Value*v);
+    /// called with the item locked after a write changed its attributes
+    /// by delta bytes, so the budget also covers later writes
+    static void resized(const ItemVal*itm, long delta) {
+        if (is_open() && delta) resized_slow(itm,delta);
+    };
+    /// same, estimating all the attributes again after a bulk write
+    static void reestimate(const ItemVal*itm);
+    /// open the page store, a dump file, and give the number of stubs
+    static unsigned long open(const std::string&path, size_t budgetbytes);
+    /// write back every dirty paged in item
+    static void sync(void);
+    /// fault in every item, so the heap is complete again, then close
+    static void close(void);
+    /// write back the dirty items, stop the evictor and close the store,
+    /// leaving the paged out items empty; for exit. A write failure is
+    /// thrown once the evictor is stopped
+    static void stop(void);
+    static Json::Value stats_json(void);
+};
+
 class ItemVal : public Value {
     const std::shared_ptr<const StrVal> _iradix;
     const uint64_t _irank;
     uint _ihash;
     std::unique_ptr<Payload> _ipayload;
-    std::map<ItemPtr,ValuePtr> _iattrmap;
+    mutable std::map<ItemPtr,ValuePtr> _iattrmap;	// faulted in by the Pager
+    // the version is bumped by every change of the attributes, under _imtx
+    std::atomic<uint64_t> _iversion;
+    mutable std::mutex _imtx;
+    // used by the Pager only
+    mutable std::atomic<PageState> _ipagestate;
+    mutable std::atomic<bool> _ipageref;
+    mutable uint64_t _ipageoff;		// in the page store
+    mutable uint64_t _isavedversion;	// version of the stored content
+    mutable size_t _ipagebytes;
+    friend class Transaction;
+    friend class Pager;
+    Json::Value content_json_locked(void) const;
+    void content_from_json_locked(const Json::Value&) const;
     static std::map<QString,std::shared_ptr<StrVal>> _radix_dict_;
-    static const StrVal*register_radix(const QString&str);
-    static const StrVal*find_radix(const QString&str);
+    // every registered item, by radix then rank; they are never freed
+    static std::map<const StrVal*,std::map<uint64_t,ItemPtr>> _radix_items_;
+    static std::recursive_mutex _radix_mtx_;
     virtual void scan_items(std::function<bool(ItemVal*)>scanfun)
     {
         (void)scanfun(this);
@@ -446,14 +692,110 @@ class ItemVal : public Value {
         if (!h) h = (hr&0xfffff) + 3*(rk&0xffff) + 17;
         return h;
     }
-    ItemVal(const StrVal*pradix,uint64_t rk)
-        : _iradix(pradix),_irank(rk), _ihash(hash_str_rank(pradix,rk)),
+    ItemVal(const std::shared_ptr<const StrVal>&pradix,uint64_t rk)
+        : _iradix(pradix),_irank(rk), _ihash(hash_str_rank(pradix.get(),rk)),
           _ipayload(),
-          _iattrmap() {
+          _iattrmap(),
+          _iversion(0),
+          _imtx(),
+          _ipagestate(PageState::Resident),
+          _ipageref(false),
+          _ipageoff(0),
+          _isavedversion(0),
+          _ipagebytes(0) {
         if (!pradix) throw std::runtime_error("nil radix for item");
+        Stats::count_make(ValKind::Item,sizeof(ItemVal));
     };
 public:
     static bool valid_radix(const QString&);
+    virtual ~ItemVal() {
+        Stats::count_free(ValKind::Item,sizeof(ItemVal));
+    };
+    static unsigned nb_radixes(void);
+    static const StrVal*register_radix(const QString&str);
+    static const StrVal*find_radix(const QString&str);
+    /// make a fresh item of given radix with the next rank, or nil if the radix is invalid
+    static ItemPtr make(const QString&radix);
+    /// ranks of transient items have their top bit set
+    static constexpr const uint64_t transient_rank = (uint64_t)1<<63;
+    /// make an unregistered item, freed with its last reference, which
+    /// is never found, scanned, dumped or paged
+    static ItemPtr make_transient(const QString&radix);
+    bool transient(void) const {
+        return (_irank & transient_rank) != 0;
+    };
+    static ItemPtr find(const QString&radix, uint64_t rank);
+    /// used by loading, the rank should not be given to another item
+    static ItemPtr find_or_make(const QString&radix, uint64_t rank);
+    static unsigned long nb_items(void);
+    /// scan every registered item in order, till the function gives false
+    static void scan_all_items(std::function<bool(ItemVal*)> scanfun);
+    /// a cursor on the registry: up to nb registered items following
+    /// the given one (or the first ones if nil), in the scan order
+    static std::vector<ItemVal*> items_after(const ItemVal*itm, unsigned nb);
+    /// the attributes and their values, the item reference itself
+    Json::Value content_to_json(void) const;
+    /// replace the attributes with those in the JSON content
+    void content_from_json(const Json::Value&);
+    Payload* payload(void) const {
+        return _ipayload.get();
+    };
+    void put_payload(Payload*py) {
+        _ipayload.reset(py);
+    };
+    const StrVal* radix(void) const {
+        return _iradix.get();
+    };
+    uint64_t rank(void) const {
+        return _irank;
+    };
+    uint64_t version(void) const {
+        return _iversion.load();
+    };
+    PageState page_state(void) const {
+        return _ipagestate.load();
+    };
+    /// attribute access, each call is atomic; use a Transaction to
+    /// update several attributes or items together
+    ValuePtr get_attr(ItemPtr attr) const {
+        std::lock_guard<std::mutex> gu(_imtx);
+        Pager::touch(this);
+        auto it = _iattrmap.find(attr);
+        if (it == _iattrmap.end()) return nullptr;
+        return it->second;
+    };
+    /// putting a nil value removes the attribute
+    void put_attr(ItemPtr attr, ValuePtr val) {
+        if (!attr) return;
+        std::lock_guard<std::mutex> gu(_imtx);
+        Pager::touch(this);
+        if (Pager::is_open()) {
+            auto it = _iattrmap.find(attr);
+            Pager::resized(this, (long)Pager::attr_bytes(val.get())
+                           - (long)Pager::attr_bytes(it==_iattrmap.end() ? nullptr : it->second.get()));
+        }
+        if (val) _iattrmap[attr] = val;
+        else _iattrmap.erase(attr);
+        _iversion++;
+    };
+    void remove_attr(ItemPtr attr) {
+        put_attr(attr,nullptr);
+    };
+    /// bulk put, sorting the attributes once; the last of equal
+    /// attributes wins, nil values remove
+    void put_attrs(std::vector<std::pair<ItemPtr,ValuePtr>>&attrvals);
+    unsigned nb_attrs(void) const {
+        std::lock_guard<std::mutex> gu(_imtx);
+        Pager::touch(this);
+        return _iattrmap.size();
+    };
+    /// scan the attributes under the item lock, till the function gives false
+    void scan_attrs(std::function<bool(ItemPtr,ValuePtr)> scanfun) const {
+        std::lock_guard<std::mutex> gu(_imtx);
+        Pager::touch(this);
+        for (auto&av : _iattrmap)
+            if (!scanfun(av.first,av.second)) return;
+    };
     virtual uint hash(void) const {
         return _ihash;
     };
@@ -461,6 +803,7 @@ public:
         return ValKind::Item;
     };
     virtual Json::Value to_json(void) const {
+        IACA_TRACE_SCOPE("ItemVal::to_json");
         Json::Value js {Json::objectValue};
         js["item"] = _iradix->val().toStdString();
         if (_irank>0) js["irank"] = (Json::Int64)_irank;
@@ -489,6 +832,306 @@ inline bool Value::less_val<ItemVal>(const ItemVal*it1, const ItemVal*it2)
     return ItemVal::less(it1,it2);
 };
 
+
+/// dump and load the item heap as JSON lines, one item per line;
+/// tasklet items are transient and not dumped
+class Dumper {
+    /// serialize the dumped items in shards, by agenda tasklets when
+    /// possible, and give every shard in order to the function
+    static unsigned long serialize_shards(unsigned nbshards,
+                                          std::function<void(unsigned,const std::string&)> shardfun);
+public:
+    static bool dumped(const ItemVal*itm);
+    static unsigned long dump_items(std::ostream&out);
+    static unsigned long dump_file(const std::string&path);
+    /// same output as dump_items, serialized in parallel
+    static unsigned long parallel_dump_items(std::ostream&out, unsigned nbshards=0);
+    static unsigned long parallel_dump_file(const std::string&path, unsigned nbshards=0);
+    /// write the shards into files prefix-00000.jsonl, prefix-00001.jsonl, ...
+    static unsigned long parallel_dump_shards(const std::string&prefix, unsigned nbshards=0);
+    /// give the number of loaded items, throw on bad input
+    static unsigned long load_items(std::istream&in);
+    static unsigned long load_file(const std::string&path);
+};
+
+/// the batch command pipeline: JSON lines read from a stream, parsed
+/// by one thread and applied in batches by the calling thread. Parsing
+/// does not touch the heap, items are made or found when applied, so
+/// the commands keep their order. Commands:
+///  {"cmd":"item","radix":R[,"irank":N]}       make or find an item
+///  {"cmd":"put","item":I,"attr":A,"val":V}    put (or remove if V is null)
+///  {"cmd":"get","item":I,"attr":A}            print the value
+///  {"cmd":"query","item":I}                   print the item content
+///  {"cmd":"tuple","comp":[I...]}              print the tuple
+///  {"cmd":"set","elem":[I...]}                print the set
+///  {"cmd":"select","where":E}                 print the items satisfying the
+///                                             C++ expression E of itm, see Module
+///  {"cmd":"dump","file":F}                    dump all items
+/// where I and A are item references {"item":R,"irank":N} and V any value.
+class BatchPipeline {
+public:
+    static constexpr const unsigned batch_size = 4096;
+    /// give the number of commands applied, errors go to stderr
+    static unsigned long run(std::istream&in, std::ostream&out);
+};
+
+/// the sharded item space: a coordinator routes the batch commands to
+/// shard processes, each an `iaca --batch --shard-serve SOCKET` owning
+/// the items whose radix hashes to it. Other items are only referenced
+/// there. Requests are pipelined as binary frames over Unix domain
+/// sockets, see iacashard.cc. In sharded mode the dump command writes
+/// one file F-00000.jsonl, F-00001.jsonl, ... per shard.
+class Shard {
+    static int _shindex_;	// -1 unless serving
+    static unsigned _shcount_;
+public:
+    static unsigned shard_of(const QString&radix, unsigned nbshards) {
+        return qHash(radix) % nbshards;
+    };
+    /// false only when serving a shard not owning the item
+    static bool owns(const ItemVal*itm) {
+        return _shindex_ < 0
+               || shard_of(itm->radix()->val(),_shcount_) == (unsigned)_shindex_;
+    };
+    /// make this process serve shard index of count
+    static void set_shard(unsigned index, unsigned count) {
+        _shindex_ = index;
+        _shcount_ = count;
+    };
+    /// serve one coordinator connection on the socket, give the number of requests
+    static unsigned long serve(const std::string&sockpath);
+    /// spawn the shard processes running program, and route the JSON lines
+    /// commands of BatchPipeline to them; give the number of commands
+    static unsigned long coordinate(std::istream&in, std::ostream&out,
+                                    unsigned nbshards, const std::string&program);
+};
+
+/// parameters of a synthetic world, see WorldGen
+struct WorldParams {
+    unsigned _wnbradix = 10;
+    unsigned _witemsperradix = 1000;
+    unsigned _wfanout = 4;	// attributes per item
+    double _wtuplesize = 8.0;	// mean tuple size, 0 for empty tuples
+    double _wsetsize = 8.0;	// mean set size, 0 for empty sets
+    double _wsharedratio = 0.1;	// probability to reuse an existing value
+    unsigned _wseed = 1;
+    /// parse a spec like radix=100,items=1000,fanout=4,tuple=8,set=8,shared=0.1,seed=1
+    bool parse(const QString&spec);
+    Json::Value to_json(void) const;
+};
+
+/// generator of synthetic knowledge bases through the ordinary
+/// ItemVal, TupleVal and SetVal factories
+class WorldGen {
+public:
+    /// give the generated items, radix by radix
+    static std::vector<ItemPtr> generate(const WorldParams&);
+};
+
+/// optimistic transaction over item attributes: reads record the
+/// version of their item, writes are buffered, and commit locks the
+/// touched items in address order, checks that no read version
+/// changed, then applies the writes. A failed commit discards
+/// everything, so Transaction::run simply retries.
+class Transaction {
+    std::map<ItemVal*,uint64_t> _trreadset;
+    std::map<ItemVal*,std::map<ItemPtr,ValuePtr>> _trwriteset;
+    std::vector<ItemPtr> _trkeep;	// keep the touched items alive
+    bool _trdoomed;		// some item changed since we read it
+public:
+    Transaction() : _trreadset(), _trwriteset(), _trkeep(), _trdoomed(false) {};
+    ~Transaction() {};
+    ValuePtr get_attr(ItemPtr itp, ItemPtr attr);
+    void put_attr(ItemPtr itp, ItemPtr attr, ValuePtr val);
+    void remove_attr(ItemPtr itp, ItemPtr attr) {
+        put_attr(itp,attr,nullptr);
+    };
+    /// give true if the writes have been applied
+    bool commit(void);
+    /// run the function in fresh transactions till one commits, and
+    /// give the number of attempts
+    static unsigned run(std::function<void(Transaction&)> fun);
+};
+
+/// priorities of tasklets in the agenda, the higher the sooner
+enum class TaskPrio :uint8_t {
+    Low,
+    Normal,
+    High,
+    Urgent,
+};
+constexpr const unsigned nb_task_prio = 4;
+
+typedef std::function<void(ItemPtr)> TaskletFun;
+
+/// the payload of tasklet items, the function gets the tasklet item
+class TaskletPayload : public Payload {
+    const TaskletFun _tfun;
+public:
+    TaskletPayload(ItemVal*own, const TaskletFun&fun)
+        : Payload(own), _tfun(fun) {};
+    virtual ~TaskletPayload() {};
+    void run(ItemPtr itp) const {
+        if (_tfun) _tfun(itp);
+    };
+};
+
+/// the agenda, in the spirit of CAIA, runs tasklet items in worker
+/// threads; each worker has one deque per priority, it pops its own
+/// tasklets from the back and steals those of other workers from the front
+class Agenda {
+    struct Worker {
+        std::mutex _wmtx;
+        std::deque<ItemPtr> _wdeque[nb_task_prio];
+        std::thread _wthread;
+    };
+    static std::vector<std::unique_ptr<Worker>> _workers_;
+    static thread_local int _curworkix_;
+    static std::mutex _agmtx_;
+    static std::condition_variable _agcond_;
+    static std::condition_variable _drain_cond_;
+    static std::atomic<long> _nbqueued_;
+    static std::atomic<long> _nbpending_;
+    static std::atomic<unsigned> _addcount_;
+    static std::atomic<bool> _stopping_;
+    static ItemPtr pop_tasklet(unsigned wix);
+    static void work_loop(unsigned wix);
+    static void run_tasklet(ItemPtr itp);
+public:
+    /// add a tasklet item; from a worker thread it goes into its own deque
+    static void add_tasklet(ItemPtr itp, TaskPrio prio=TaskPrio::Normal);
+    /// make a fresh transient tasklet item of given radix and add it; it
+    /// is freed once run, unless referenced elsewhere
+    static ItemPtr make_tasklet(const QString&radix, const TaskletFun&fun,
+                                TaskPrio prio=TaskPrio::Normal);
+    static void start(unsigned nbworkers);
+    /// wait till no tasklet is queued or running
+    static void drain(void);
+    static void stop(void);
+    static unsigned nb_workers(void) {
+        return _workers_.size();
+    };
+    /// the index of the current worker, or -1 outside of workers
+    static int current_worker(void) {
+        return _curworkix_;
+    };
+};
+
+/// runtime generated C++ modules, compiled out of process into shared
+/// objects and dlopen-ed. The shared objects are cached in a directory
+/// under a hash of their source, of the compile command and of iaca.hh,
+/// so an unchanged module is loaded without compiling after a restart.
+/// Modules are never unloaded.
+class Module {
+    static std::mutex _modmtx_;
+    static std::condition_variable _modcond_;
+    static std::map<std::string,void*> _modhandles_;	// by key, null while compiling
+    static std::string _moddir_;
+    static std::string _modcommand_;
+    static std::atomic<unsigned long> _modnbcompiled_, _modnbcached_;
+    static std::string key(const std::string&source);
+    static void* compile_and_open(const std::string&key, const std::string&source);
+public:
+    /// by default $IACA_MODULE_DIR, else ~/.cache/iaca/modules
+    static std::string cache_dir(void);
+    static void set_cache_dir(const std::string&dir);
+    /// the compiler and its flags, to which -o and the files are appended
+    static std::string compile_command(void);
+    static void set_compile_command(const std::string&cmd);
+    /// give the dlopen handle of a module, compiling it unless cached
+    static void* load(const std::string&source);
+    /// the address of an extern "C" symbol of a module, throw if missing
+    static void* symbol(void*handle, const char*name);
+    /// a predicate whose body is a C++ expression of the item `itm'
+    static std::function<bool(ItemVal*)> compile_query(const std::string&expr);
+    /// a tasklet function whose body is C++ statements using the tasklet item `itp'
+    static TaskletFun compile_tasklet(const std::string&body);
+    /// modules compiled, and loaded from the cache, by this process
+    static unsigned long nb_compiled(void) {
+        return _modnbcompiled_.load();
+    };
+    static unsigned long nb_cached(void) {
+        return _modnbcached_.load();
+    };
+};
+
+/// a lazy tree model for browsing items and values in the GUI: rows
+/// are fetched by chunks through canFetchMore/fetchMore, the items of
+/// the nil root by a cursor on the registry. The attributes of an item
+/// are listed, and the value summaries rendered into a bounded cache,
+/// by an agenda tasklet, since that may fault items in
+class ItemModel : public QAbstractItemModel {
+    Q_OBJECT
+public:
+    static constexpr const int fetch_chunk = 256;
+    static constexpr const int cache_size = 8192;
+    static QString item_name(const ItemVal*itm);
+    /// a short text for a value, which may fault in a paged item
+    static QString summary(const Value*val);
+private:
+    struct Node {
+        Node* _nparent;
+        int _nrow;
+        QString _nlabel;
+        ValuePtr _nval;
+        bool _nlisted;	// _nattrs is filled, or every root item fetched
+        bool _nlisting;	// _nattrs is being listed
+        std::vector<std::pair<ItemPtr,ValuePtr>> _nattrs;
+        std::vector<std::unique_ptr<Node>> _nchildren;
+    };
+    // renders the summaries of _jvals, or lists the attributes of _jitem
+    struct RenderJob {
+        unsigned _jgen;
+        Node* _jparent;
+        int _jfirst, _jlast;
+        std::vector<ValuePtr> _jvals;
+        std::vector<QString> _jtexts;
+        ValuePtr _jitem;
+        std::vector<std::pair<ItemPtr,ValuePtr>> _jattrs;
+    };
+    std::unique_ptr<Node> _mroot;
+    unsigned _mgen;		// bumped by set_root, to ignore stale jobs
+    mutable QCache<const Value*,QString> _mcache;
+    mutable std::mutex _mjobmtx;
+    mutable std::condition_variable _mjobcond;
+    // jobs are queued for a single renderer tasklet, started when needed
+    mutable std::deque<RenderJob> _mtodojobs;
+    mutable std::vector<RenderJob> _mdonejobs;
+    mutable unsigned _mnbrunning;	// jobs queued or being rendered
+    mutable bool _mrendering;	// a renderer tasklet runs
+    mutable std::set<const Value*> _mpending;	// values being rendered
+    Node* node_of(const QModelIndex&idx) const {
+        return idx.isValid() ? static_cast<Node*>(idx.internalPointer()) : _mroot.get();
+    };
+    QModelIndex index_of(Node*nd) const {
+        if (!nd || nd == _mroot.get()) return QModelIndex();
+        return createIndex(nd->_nrow,0,nd);
+    };
+    void insert_rows(Node*nd, std::vector<std::pair<QString,ValuePtr>>&rows);
+    void queue_job(RenderJob&&job) const;
+    void render_rows(Node*parent, int first, int last) const;
+    void render_queued(void);
+    void wait_renders(void);
+public:
+    /// a nil root shows every item
+    ItemModel(ValuePtr root=nullptr, QObject*parent=nullptr);
+    virtual ~ItemModel();
+    void set_root(ValuePtr root);
+    virtual QModelIndex index(int row, int column, const QModelIndex&parent=QModelIndex()) const;
+    virtual QModelIndex parent(const QModelIndex&idx) const;
+    virtual int rowCount(const QModelIndex&parent=QModelIndex()) const;
+    virtual int columnCount(const QModelIndex&parent=QModelIndex()) const;
+    virtual bool hasChildren(const QModelIndex&parent=QModelIndex()) const;
+    virtual bool canFetchMore(const QModelIndex&parent) const;
+    virtual void fetchMore(const QModelIndex&parent);
+    virtual QVariant data(const QModelIndex&idx, int role=Qt::DisplayRole) const;
+    virtual QVariant headerData(int section, Qt::Orientation orient, int role=Qt::DisplayRole) const;
+signals:
+    void rendered(void);
+private slots:
+    void apply_rendered(void);
+};
+
 Json::Value ItemPtr::to_json(void) const {
     const ItemVal*pitm = get();
     if (pitm) return pitm->to_json();
@@ -0,0 +1,293 @@
+// file iacabatch.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacabatch.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <iostream>
+#include <unordered_map>
+
+using namespace Iaca;
+
+namespace {
+enum class CmdKind :uint8_t {
+    Bad,
+    Item,
+    Put,
+    Get,
+    Query,
+    Tuple,
+    Set,
+    Select,
+    Dump,
+};
+
+// a parsed command; its items and values are made only when applied,
+// since the parser runs ahead of the applier
+struct BatchCommand {
+    CmdKind _ckind;
+    unsigned long _clineno;
+    Json::Value _cjson;
+    std::string _cstr;		// dump file, or error message
+    std::function<bool(ItemVal*)> _cquery;
+};
+
+typedef std::vector<BatchCommand> CommandBatch;
+
+// a bounded queue of parsed batches between the two stages
+class BatchQueue {
+    std::mutex _qmtx;
+    std::condition_variable _qcond;
+    std::deque<CommandBatch> _qbatches;
+    bool _qdone = false;
+    static constexpr const unsigned max_batches = 8;
+public:
+    void push(CommandBatch&&cb) {
+        std::unique_lock<std::mutex> lk(_qmtx);
+        _qcond.wait(lk, [&] {
+            return _qbatches.size() < max_batches;
+        });
+        _qbatches.push_back(std::move(cb));
+        _qcond.notify_all();
+    };
+    void finish(void) {
+        std::lock_guard<std::mutex> gu(_qmtx);
+        _qdone = true;
+        _qcond.notify_all();
+    };
+    // give false at the end
+    bool pop(CommandBatch&cb) {
+        std::unique_lock<std::mutex> lk(_qmtx);
+        _qcond.wait(lk, [&] {
+            return _qdone || !_qbatches.empty();
+        });
+        if (_qbatches.empty()) return false;
+        cb = std::move(_qbatches.front());
+        _qbatches.pop_front();
+        _qcond.notify_all();
+        return true;
+    };
+};
+
+BatchCommand
+parse_command(Json::Value&&js, unsigned long lineno)
+{
+    BatchCommand bc {CmdKind::Bad, lineno, Json::Value(), "", nullptr};
+    std::string cmd = js["cmd"].asString();
+    if (cmd == "item")
+        bc._ckind = CmdKind::Item;
+    else if (cmd == "put")
+        bc._ckind = CmdKind::Put;
+    else if (cmd == "get")
+        bc._ckind = CmdKind::Get;
+    else if (cmd == "query")
+        bc._ckind = CmdKind::Query;
+    else if (cmd == "tuple" || cmd == "set") {
+        js["kind"] = cmd;
+        bc._ckind = (cmd == "tuple") ? CmdKind::Tuple : CmdKind::Set;
+    }
+    else if (cmd == "select") {
+        // compiled here, so the applying stage does not wait for the compiler
+        bc._cquery = Module::compile_query(js["where"].asString());
+        bc._ckind = CmdKind::Select;
+    }
+    else if (cmd == "dump") {
+        bc._cstr = js["file"].asString();
+        if (bc._cstr.empty()) throw std::runtime_error("no dump file");
+        bc._ckind = CmdKind::Dump;
+    }
+    else
+        throw std::runtime_error("unknown command " + cmd);
+    bc._cjson.swap(js);
+    return bc;
+}
+
+ItemPtr
+command_item(const Json::Value&js, const char*field)
+{
+    ItemPtr itp = ItemPtr::from_json(js[field]);
+    if (!itp) throw std::runtime_error(std::string("bad ") + field);
+    return itp;
+}
+
+// the parsing stage, run in its own thread
+void
+parse_stage(std::istream&in, BatchQueue&queue)
+{
+    Json::CharReaderBuilder rbuild;
+    std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+    std::string line;
+    unsigned long lineno = 0;
+    CommandBatch cb;
+    cb.reserve(BatchPipeline::batch_size);
+    while (std::getline(in,line)) {
+        lineno++;
+        if (line.empty() || line[0] == '#') continue;
+        Json::Value js;
+        std::string errs;
+        try {
+            if (!reader->parse(line.data(),line.data()+line.size(),&js,&errs))
+                throw std::runtime_error("bad JSON: " + errs);
+            cb.push_back(parse_command(std::move(js),lineno));
+        }
+        catch (const std::exception&ex) {
+            cb.push_back({CmdKind::Bad, lineno, Json::Value(), ex.what(), nullptr});
+        }
+        if (cb.size() >= BatchPipeline::batch_size) {
+            queue.push(std::move(cb));
+            cb = CommandBatch();
+            cb.reserve(BatchPipeline::batch_size);
+        }
+    }
+    if (!cb.empty()) queue.push(std::move(cb));
+    queue.finish();
+}
+
+// the applying stage; puts are gathered per item and applied in bulk
+// before any command reading the heap
+class Applier {
+    std::ostream&_aout;
+    Json::StreamWriterBuilder _awbuild;
+    std::unordered_map<ItemVal*,std::vector<std::pair<ItemPtr,ValuePtr>>> _apending;
+    unsigned long _aputlineno;	// line of the last pending put
+    // the puts of an item which failed, e.g. reading the page store, are
+    // lost; the first failure is thrown once the other items are done
+    void flush(void) {
+        auto pending = std::move(_apending);
+        _apending.clear();
+        std::exception_ptr err;
+        for (auto&p : pending) {
+            try {
+                p.first->put_attrs(p.second);
+            }
+            catch (...) {
+                if (!err) err = std::current_exception();
+            }
+        }
+        if (err) std::rethrow_exception(err);
+    };
+    void report(unsigned long lineno, const std::exception&ex) {
+        std::cerr << "iaca: command at line " << lineno
+                  << " failed: " << ex.what() << std::endl;
+    };
+    void print(const Json::Value&js) {
+        _aout << Json::writeString(_awbuild,js) << '\n';
+    };
+public:
+    Applier(std::ostream&out) : _aout(out), _awbuild(), _apending(), _aputlineno(0) {
+        _awbuild["indentation"] = "";
+    };
+    // apply the remaining puts
+    void finish(void) {
+        try {
+            flush();
+        }
+        catch (const std::exception&ex) {
+            report(_aputlineno,ex);
+        }
+        _aout.flush();
+    };
+    void apply(CommandBatch&cb) {
+        IACA_TRACE_SCOPE("BatchPipeline::apply");
+        for (BatchCommand&bc : cb) {
+            try {
+                switch (bc._ckind) {
+                case CmdKind::Bad:
+                    throw std::runtime_error(bc._cstr);
+                case CmdKind::Put: {
+                    ItemPtr itp = command_item(bc._cjson,"item");
+                    ItemPtr attr = command_item(bc._cjson,"attr");
+                    _apending[itp.get()].emplace_back(attr,ValuePtr::from_json(bc._cjson["val"]));
+                    _aputlineno = bc._clineno;
+                }
+                break;
+                case CmdKind::Item: {
+                    const Json::Value&js = bc._cjson;
+                    QString radix = QString::fromStdString(js["radix"].asString());
+                    ItemPtr itp = js.isMember("irank")
+                                  ? ItemVal::find_or_make(radix,js["irank"].asUInt64())
+                                  : ItemVal::make(radix);
+                    if (!itp) throw std::runtime_error("invalid radix");
+                    print(itp.to_json());
+                }
+                break;
+                case CmdKind::Get: {
+                    ItemPtr itp = command_item(bc._cjson,"item");
+                    ItemPtr attr = command_item(bc._cjson,"attr");
+                    flush();
+                    print(itp->get_attr(attr).to_json());
+                }
+                break;
+                case CmdKind::Query: {
+                    ItemPtr itp = command_item(bc._cjson,"item");
+                    flush();
+                    print(itp->content_to_json());
+                }
+                break;
+                case CmdKind::Tuple:
+                case CmdKind::Set:
+                    print(ValuePtr::from_json(bc._cjson).to_json());
+                    break;
+                case CmdKind::Select: {
+                    flush();
+                    Json::Value jitems {Json::arrayValue};
+                    ItemVal::scan_all_items([&](ItemVal*itm) {
+                        if (Dumper::dumped(itm) && bc._cquery(itm))
+                            jitems.append(itm->to_json());
+                        return true;
+                    });
+                    print(jitems);
+                }
+                break;
+                case CmdKind::Dump:
+                    flush();
+                    Dumper::dump_file(bc._cstr);
+                    break;
+                }
+            }
+            catch (const std::exception&ex) {
+                report(bc._clineno,ex);
+            }
+        }
+        finish();
+    };
+};
+};
+
+unsigned long
+BatchPipeline::run(std::istream&in, std::ostream&out)
+{
+    BatchQueue queue;
+    std::thread parser([&] {
+        parse_stage(in,queue);
+    });
+    unsigned long nb = 0;
+    CommandBatch cb;
+    try {
+        Applier applier(out);
+        while (queue.pop(cb)) {
+            applier.apply(cb);
+            nb += cb.size();
+        }
+    }
+    catch (...) {
+        // the parser may wait for room in the queue
+        while (queue.pop(cb)) {}
+        parser.join();
+        throw;
+    }
+    parser.join();
+    return nb;
+}
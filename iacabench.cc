@@ -0,0 +1,462 @@
+// file iacabench.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacabench.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+/// microbenchmarks of the value core, built as iaca-bench by make bench;
+/// the output is JSON, and --compare checks it against a saved baseline.
+/// With --scale, time synthetic worlds of growing size instead.
+
+#include "iaca.hh"
+#include <chrono>
+#include <iostream>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace Iaca;
+
+bool Iaca::batch = true;
+
+// the scale step runs a parallel dump on agenda threads
+static std::atomic<unsigned long> bench_nballoc;
+
+void* operator new(size_t sz)
+{
+    bench_nballoc.fetch_add(1,std::memory_order_relaxed);
+    void*p = malloc(sz?sz:1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void*p) noexcept
+{
+    free(p);
+}
+
+static volatile uintptr_t bench_sink;
+
+struct BenchResult {
+    std::string _bname;
+    unsigned long _biter;
+    double _bnsperop;
+    double _ballocperop;
+};
+
+struct BenchWorld {
+    std::vector<QString> _wradixes;
+    std::vector<ItemPtr> _witems;
+    std::vector<std::vector<ItemPtr>> _wseqs;	// random item sequences
+    std::vector<std::vector<ItemVal*>> _warrays;	// same as the sequences
+    std::vector<const TupleVal*> _wtuples;
+    std::vector<ValuePtr> _wvalues;		// tuples and items, for less
+    std::vector<QString> _wstrings;
+    BenchWorld(unsigned nbitems, unsigned seqlen, unsigned seed);
+    ~BenchWorld() {
+        for (auto tup : _wtuples) delete static_cast<const Value*>(tup);
+    };
+};
+
+BenchWorld::BenchWorld(unsigned nbitems, unsigned seqlen, unsigned seed)
+{
+    std::mt19937 rand(seed);
+    unsigned nbradix = 1 + nbitems/16;
+    for (unsigned ix=0; ix<nbradix; ix++)
+        _wradixes.push_back(QString("radix") + QString::number(ix));
+    for (unsigned ix=0; ix<nbitems; ix++)
+        _witems.push_back(ItemVal::make(_wradixes[rand()%nbradix]));
+    for (unsigned ix=0; ix<256; ix++) {
+        std::vector<ItemPtr> seq;
+        for (unsigned jx=0; jx<seqlen; jx++)
+            seq.push_back(_witems[rand()%nbitems]);
+        _wseqs.push_back(seq);
+        std::vector<ItemVal*> arr;
+        for (ItemPtr itp : seq) arr.push_back(itp.get());
+        _warrays.push_back(arr);
+        const TupleVal*tup = TupleVal::make(seq);
+        _wtuples.push_back(tup);
+    }
+    for (unsigned ix=0; ix<256; ix++) {
+        // tuples are not owned by the values, so alias them
+        if (ix%2)
+            _wvalues.push_back(ValuePtr(std::shared_ptr<Value>(),
+                                        const_cast<TupleVal*>(_wtuples[ix])));
+        else
+            _wvalues.push_back(_witems[rand()%nbitems]);
+    }
+    static const char*const samples[] = {
+        "word", "an_ident", "x42", "plain text", "été", "_under", "9lives", "Hello"
+    };
+    for (unsigned ix=0; ix<256; ix++) {
+        QString qs {samples[rand()%(sizeof(samples)/sizeof(samples[0]))]};
+        if (ix%3) qs.append(QString::number(ix));
+        _wstrings.push_back(qs);
+    }
+}
+
+template<typename F>
+static BenchResult
+run_bench(const char*name, unsigned long nbiter, unsigned nbruns, F fun)
+{
+    BenchResult res {name, nbiter, 0.0, 0.0};
+    for (unsigned r=0; r<nbruns; r++) {
+        unsigned long allocs = bench_nballoc;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i=0; i<nbiter; i++)
+            fun(i);
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double,std::nano>(end-start).count()/nbiter;
+        // keep the fastest run, the others were disturbed
+        if (r==0 || ns < res._bnsperop) {
+            res._bnsperop = ns;
+            res._ballocperop = (double)(bench_nballoc-allocs)/nbiter;
+        }
+    }
+    return res;
+}
+
+static std::vector<BenchResult>
+run_all_benches(BenchWorld&w, unsigned long nbiter, unsigned nbruns)
+{
+    std::vector<BenchResult> vres;
+    vres.push_back(run_bench("TupleVal::make", nbiter, nbruns, [&](unsigned long i) {
+        auto tup = TupleVal::make(w._wseqs[i%256]);
+        bench_sink += tup->hash();
+        delete static_cast<const Value*>(tup);
+    }));
+    vres.push_back(run_bench("SetVal::make", nbiter, nbruns, [&](unsigned long i) {
+        auto set = SetVal::make(w._wseqs[i%256]);
+        bench_sink += set->hash();
+        delete static_cast<const Value*>(set);
+    }));
+    vres.push_back(run_bench("ValuePtr::less", nbiter, nbruns, [&](unsigned long i) {
+        bench_sink += ValuePtr::less(w._wvalues[i%256], w._wvalues[(i*7+3)%256]);
+    }));
+    vres.push_back(run_bench("SeqItemsVal::hash_itemsarr", nbiter, nbruns, [&](unsigned long i) {
+        auto&arr = w._warrays[i%256];
+        bench_sink += SeqItemsVal::hash_itemsarr(arr.data(), arr.size(), i);
+    }));
+    vres.push_back(run_bench("StrVal::category", nbiter, nbruns, [&](unsigned long i) {
+        bench_sink += (uintptr_t)StrVal::category(w._wstrings[i%256]);
+    }));
+    vres.push_back(run_bench("ItemVal::register_radix", nbiter, nbruns, [&](unsigned long i) {
+        bench_sink += (uintptr_t)ItemVal::register_radix(w._wradixes[i%w._wradixes.size()]);
+    }));
+    vres.push_back(run_bench("TupleVal::to_json", nbiter, nbruns, [&](unsigned long i) {
+        bench_sink += w._wtuples[i%256]->to_json().size();
+    }));
+    vres.push_back(run_bench("ItemVal::to_json", nbiter, nbruns, [&](unsigned long i) {
+        bench_sink += w._witems[i%w._witems.size()]->to_json().size();
+    }));
+    return vres;
+}
+
+// compare with a baseline, fill jcmp and give the number of regressions;
+// the time may grow within the tolerance, the allocations not at all
+static int
+compare_benches(const std::vector<BenchResult>&vres, const Json::Value&jbase,
+                double tolerance, Json::Value&jcmp)
+{
+    int nbregress = 0;
+    std::map<std::string,const Json::Value*> baseres;
+    for (const Json::Value&jr : jbase["results"])
+        baseres[jr["name"].asString()] = &jr;
+    jcmp = Json::Value {Json::objectValue};
+    for (const BenchResult&br : vres) {
+        auto it = baseres.find(br._bname);
+        if (it == baseres.end()) continue;
+        double basens = (*it->second)["ns_per_op"].asDouble();
+        if (basens <= 0.0) continue;
+        double ratio = br._bnsperop / basens;
+        bool regress = ratio > 1.0 + tolerance/100.0;
+        Json::Value jc {Json::objectValue};
+        if (it->second->isMember("allocs_per_op")) {
+            double baseallocs = (*it->second)["allocs_per_op"].asDouble();
+            bool moreallocs = br._ballocperop > baseallocs + 1e-6;
+            jc["baseline_allocs_per_op"] = baseallocs;
+            jc["allocs_regression"] = moreallocs;
+            regress = regress || moreallocs;
+        }
+        jc["baseline_ns_per_op"] = basens;
+        jc["ratio"] = ratio;
+        jc["regression"] = regress;
+        jcmp[br._bname] = jc;
+        if (regress) nbregress++;
+    }
+    return nbregress;
+}
+
+static long
+resident_bytes(void)
+{
+    long pages = 0, respages = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> respages;
+    return respages * sysconf(_SC_PAGESIZE);
+}
+
+static double
+elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-start).count();
+}
+
+// run in a forked child, so that every world starts from an empty heap;
+// the dump is left for run_load_step
+static Json::Value
+run_scale_step(const WorldParams&wp, const std::string&dumppath)
+{
+    Json::Value js {Json::objectValue};
+    std::mt19937 rand(wp._wseed);
+    unsigned long nbitems = (unsigned long)wp._wnbradix*wp._witemsperradix;
+    js["items"] = (Json::UInt64)nbitems;
+    long rss0 = resident_bytes();
+    unsigned long allocs0 = bench_nballoc;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ItemPtr> items = WorldGen::generate(wp);
+    js["create_ns_per_item"] = elapsed_ns(start)/nbitems;
+    js["bytes_per_item"] = (double)(resident_bytes()-rss0)/nbitems;
+    js["allocs_per_item"] = (double)(bench_nballoc-allocs0)/nbitems;
+    std::vector<ItemPtr> attrs;
+    for (uint64_t rk=1; ItemPtr at = ItemVal::find("attr",rk); rk++)
+        attrs.push_back(at);
+    unsigned long nblookup = std::min(nbitems,1000000UL);
+    unsigned long nbfound = 0;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long ix=0; ix<nblookup; ix++)
+        if (items[rand()%nbitems]->get_attr(attrs[rand()%attrs.size()]))
+            nbfound++;
+    js["lookup_ns"] = elapsed_ns(start)/nblookup;
+    js["lookup_hit_ratio"] = (double)nbfound/nblookup;
+    start = std::chrono::steady_clock::now();
+    for (ItemPtr itp : items)
+        bench_sink += itp->content_to_json().size();
+    js["serialize_ns_per_item"] = elapsed_ns(start)/nbitems;
+    start = std::chrono::steady_clock::now();
+    unsigned long nbdumped = Dumper::dump_file(dumppath);
+    js["dump_ns_per_item"] = elapsed_ns(start)/nbdumped;
+    std::ifstream dumpin(dumppath, std::ios::ate|std::ios::binary);
+    js["dump_bytes_per_item"] = (double)dumpin.tellg()/nbdumped;
+    start = std::chrono::steady_clock::now();
+    Dumper::parallel_dump_file(dumppath);
+    js["parallel_dump_ns_per_item"] = elapsed_ns(start)/nbdumped;
+    std::vector<ValuePtr> vals;
+    unsigned long nbvals = std::min(nbitems,1000000UL);
+    for (unsigned long ix=0; ix<nbvals; ix++) {
+        ValuePtr v = items[rand()%nbitems]->get_attr(attrs[rand()%attrs.size()]);
+        if (v) vals.push_back(v);
+    }
+    unsigned long nbcmp = 0;
+    start = std::chrono::steady_clock::now();
+    std::sort(vals.begin(),vals.end(),[&](const ValuePtr&v1, const ValuePtr&v2) {
+        nbcmp++;
+        return ValuePtr::less(v1,v2);
+    });
+    js["compare_ns"] = nbcmp ? elapsed_ns(start)/nbcmp : 0.0;
+    return js;
+}
+
+// in another forked child, so that the dump is loaded into an empty heap
+static Json::Value
+run_load_step(const std::string&dumppath)
+{
+    Json::Value js {Json::objectValue};
+    auto start = std::chrono::steady_clock::now();
+    unsigned long nbloaded = Dumper::load_file(dumppath);
+    js["load_ns_per_item"] = elapsed_ns(start)/nbloaded;
+    return js;
+}
+
+// give the JSON result of the function run in a forked child, or null
+// if the child failed
+static Json::Value
+run_forked(std::function<Json::Value(void)> fun)
+{
+    int pipefd[2];
+    if (pipe(pipefd)) throw std::runtime_error("pipe failed");
+    pid_t pid = fork();
+    if (pid < 0) throw std::runtime_error("fork failed");
+    if (pid == 0) {
+        close(pipefd[0]);
+        Json::StreamWriterBuilder wbuild;
+        wbuild["indentation"] = "";
+        std::string str;
+        try {
+            str = Json::writeString(wbuild,fun());
+        }
+        catch (const std::exception&ex) {
+            std::cerr << "iaca-bench: " << ex.what() << std::endl;
+            _exit(1);
+        }
+        if (write(pipefd[1],str.data(),str.size()) != (ssize_t)str.size())
+            _exit(1);
+        _exit(0);
+    }
+    close(pipefd[1]);
+    std::string str;
+    char buf[1024];
+    ssize_t nbr;
+    while ((nbr = read(pipefd[0],buf,sizeof(buf))) > 0)
+        str.append(buf,nbr);
+    close(pipefd[0]);
+    int status = 0;
+    waitpid(pid,&status,0);
+    Json::Value js;
+    Json::CharReaderBuilder rbuild;
+    std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0
+            || !reader->parse(str.data(),str.data()+str.size(),&js,nullptr))
+        return Json::Value();
+    return js;
+}
+
+static Json::Value
+run_scale(WorldParams wp, unsigned long minitems, unsigned long maxitems,
+          const std::string&dumpdir)
+{
+    Json::Value jsteps {Json::arrayValue};
+    for (unsigned long nbitems=minitems; nbitems<=maxitems; nbitems*=10) {
+        wp._witemsperradix = std::max(1UL, nbitems/wp._wnbradix);
+        std::string dumppath = dumpdir + "/iaca-scale-" + std::to_string(getpid())
+                               + "-" + std::to_string(nbitems) + ".jsonl";
+        Json::Value jstep = run_forked([&] {
+            return run_scale_step(wp,dumppath);
+        });
+        Json::Value jload;
+        if (jstep.isObject())
+            jload = run_forked([&] {
+            return run_load_step(dumppath);
+        });
+        unlink(dumppath.c_str());
+        if (!jstep.isObject() || !jload.isObject()) {
+            jstep = Json::Value {Json::objectValue};
+            jstep["items"] = (Json::UInt64)nbitems;
+            jstep["failed"] = true;
+            jsteps.append(jstep);
+            break;
+        }
+        jstep["load_ns_per_item"] = jload["load_ns_per_item"];
+        jsteps.append(jstep);
+    }
+    return jsteps;
+}
+
+int main(int argc, char**argv)
+{
+    unsigned nbitems = 10000;
+    unsigned seqlen = 16;
+    unsigned seed = 12345;
+    unsigned long nbiter = 200000;
+    unsigned nbruns = 5;
+    double tolerance = 10.0;
+    const char*outpath = nullptr;
+    const char*basepath = nullptr;
+    bool scale = false;
+    unsigned long scalemin = 10000, scalemax = 1000000;
+    const char*scaledir = "/tmp";
+    WorldParams wp;
+    for (int ix=1; ix<argc; ix++) {
+        bool hasarg = ix+1<argc;
+        if (!strcmp(argv[ix],"--items") && hasarg) nbitems = atoi(argv[++ix]);
+        else if (!strcmp(argv[ix],"--seqlen") && hasarg) seqlen = atoi(argv[++ix]);
+        else if (!strcmp(argv[ix],"--seed") && hasarg) seed = atoi(argv[++ix]);
+        else if (!strcmp(argv[ix],"--iter") && hasarg) nbiter = atol(argv[++ix]);
+        else if (!strcmp(argv[ix],"--runs") && hasarg) nbruns = atoi(argv[++ix]);
+        else if (!strcmp(argv[ix],"--tolerance") && hasarg) tolerance = atof(argv[++ix]);
+        else if (!strcmp(argv[ix],"--output") && hasarg) outpath = argv[++ix];
+        else if (!strcmp(argv[ix],"--compare") && hasarg) basepath = argv[++ix];
+        else if (!strcmp(argv[ix],"--scale")) scale = true;
+        else if (!strcmp(argv[ix],"--scale-min") && hasarg) scalemin = atol(argv[++ix]);
+        else if (!strcmp(argv[ix],"--scale-max") && hasarg) scalemax = atol(argv[++ix]);
+        else if (!strcmp(argv[ix],"--scale-dir") && hasarg) scaledir = argv[++ix];
+        else if (!strcmp(argv[ix],"--world") && hasarg) {
+            if (!wp.parse(argv[++ix])) {
+                std::cerr << argv[0] << ": bad world spec " << argv[ix] << std::endl;
+                return 2;
+            }
+        }
+        else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--items N] [--seqlen N] [--seed N] [--iter N] [--runs N]"
+                      << " [--output FILE] [--compare BASELINE] [--tolerance PERCENT]\n"
+                      << "   or: " << argv[0]
+                      << " --scale [--scale-min N] [--scale-max N] [--scale-dir DIR]"
+                      << " [--world radix=..,fanout=..,tuple=..,set=..,shared=..,seed=..]"
+                      << " [--output FILE]"
+                      << std::endl;
+            return 2;
+        }
+    }
+    if (nbitems==0 || seqlen==0 || nbiter==0 || nbruns==0 || scalemin==0) {
+        std::cerr << argv[0] << ": counts should be positive" << std::endl;
+        return 2;
+    }
+    Json::Value jout {Json::objectValue};
+    jout["commit"] = iaca_lastgitcommit;
+    Json::StreamWriterBuilder wbuild;
+    wbuild["indentation"] = " ";
+    if (scale) {
+        jout["world"] = wp.to_json();
+        jout["world"].removeMember("items");	// set by each scale step
+        jout["scale"] = run_scale(wp,scalemin,scalemax,scaledir);
+        std::string outstr = Json::writeString(wbuild,jout);
+        if (outpath) {
+            std::ofstream out(outpath);
+            out << outstr << std::endl;
+        }
+        std::cout << outstr << std::endl;
+        return 0;
+    }
+    BenchWorld world(nbitems,seqlen,seed);
+    auto vres = run_all_benches(world,nbiter,nbruns);
+    jout["items"] = nbitems;
+    jout["seqlen"] = seqlen;
+    jout["seed"] = seed;
+    jout["iterations"] = (Json::UInt64)nbiter;
+    jout["runs"] = nbruns;
+    Json::Value jres {Json::arrayValue};
+    for (const BenchResult&br : vres) {
+        Json::Value jr {Json::objectValue};
+        jr["name"] = br._bname;
+        jr["ns_per_op"] = br._bnsperop;
+        jr["allocs_per_op"] = br._ballocperop;
+        jr["ops_per_sec"] = br._bnsperop>0.0 ? 1.0e9/br._bnsperop : 0.0;
+        jres.append(jr);
+    }
+    jout["results"] = jres;
+    int nbregress = 0;
+    if (basepath) {
+        std::ifstream basein(basepath);
+        Json::Value jbase;
+        Json::CharReaderBuilder rbuild;
+        std::string errs;
+        if (!basein || !Json::parseFromStream(rbuild, basein, &jbase, &errs)) {
+            std::cerr << argv[0] << ": cannot read baseline " << basepath
+                      << ": " << errs << std::endl;
+            return 2;
+        }
+        Json::Value jcmp;
+        nbregress = compare_benches(vres,jbase,tolerance,jcmp);
+        jout["compare"] = jcmp;
+        jout["regressions"] = nbregress;
+    }
+    std::string outstr = Json::writeString(wbuild,jout);
+    if (outpath) {
+        std::ofstream out(outpath);
+        out << outstr << std::endl;
+    }
+    std::cout << outstr << std::endl;
+    return nbregress>0 ? 1 : 0;
+}
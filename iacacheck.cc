@@ -0,0 +1,218 @@
+// file iacacheck.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacacheck.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+/// regression checks of the concurrent parts: transactions, agenda,
+/// shards and pager, built as iaca-check by make check. Each check
+/// prints a line, and the exit code is the number of failed checks.
+
+#include "iaca.hh"
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <cstring>
+#include <unistd.h>
+
+using namespace Iaca;
+
+bool Iaca::batch = true;
+
+static int check_failures;
+
+static void
+check(bool ok, const std::string&what)
+{
+    std::cout << (ok ? "ok   " : "FAIL ") << what << std::endl;
+    if (!ok) check_failures++;
+}
+
+static intptr_t
+int_of(const ValuePtr&v)
+{
+    if (!v || v.kind() != ValKind::Int) return 0;
+    return static_cast<const IntVal*>(v.get())->val();
+}
+
+// threads move money between two accounts, in both directions so that
+// commits lock the items in both orders; the total must never change,
+// as seen by concurrent read-only transactions
+static void
+check_transactions(void)
+{
+    const unsigned nbthreads = 8;
+    const unsigned nbtransfers = 20000;
+    const intptr_t total = 1000;
+    ItemPtr acc1 = ItemVal::make("check_account");
+    ItemPtr acc2 = ItemVal::make("check_account");
+    ItemPtr balance = ItemVal::make("check_balance");
+    acc1->put_attr(balance, ValuePtr(new IntVal(total)));
+    acc2->put_attr(balance, ValuePtr(new IntVal(0)));
+    std::atomic<unsigned long> nbattempts {0};
+    std::atomic<unsigned long> nbbadsums {0};
+    std::atomic<bool> done {false};
+    std::vector<std::thread> threads;
+    for (unsigned tix=0; tix<nbthreads; tix++)
+        threads.emplace_back([&,tix] {
+        std::mt19937 rand(tix);
+        for (unsigned ix=0; ix<nbtransfers; ix++) {
+            bool forward = rand()%2;
+            intptr_t amount = rand()%10;
+            nbattempts += Transaction::run([&](Transaction&tr) {
+                ItemPtr from = forward ? acc1 : acc2;
+                ItemPtr to = forward ? acc2 : acc1;
+                intptr_t f = int_of(tr.get_attr(from,balance));
+                intptr_t t = int_of(tr.get_attr(to,balance));
+                intptr_t a = std::min(amount,f);
+                tr.put_attr(from, balance, ValuePtr(new IntVal(f-a)));
+                tr.put_attr(to, balance, ValuePtr(new IntVal(t+a)));
+            });
+        }
+    });
+    std::thread reader([&] {
+        while (!done.load()) {
+            intptr_t sum = 0;
+            Transaction::run([&](Transaction&tr) {
+                sum = int_of(tr.get_attr(acc1,balance)) + int_of(tr.get_attr(acc2,balance));
+            });
+            if (sum != total) nbbadsums++;
+        }
+    });
+    for (auto&t : threads) t.join();
+    done.store(true);
+    reader.join();
+    intptr_t sum = int_of(acc1->get_attr(balance)) + int_of(acc2->get_attr(balance));
+    check(sum == total, "transactions keep the total of " + std::to_string(nbthreads*nbtransfers)
+          + " transfers, in " + std::to_string(nbattempts.load()) + " attempts");
+    check(nbbadsums.load() == 0, "committed reads see a constant total");
+}
+
+// tasklets adding more tasklets, on every priority; they are transient
+// so the registry does not grow
+static void
+check_agenda(void)
+{
+    const unsigned nbtasklets = 10000;
+    unsigned long nbitems = ItemVal::nb_items();
+    std::atomic<unsigned> nbrun {0};
+    Agenda::start(4);
+    for (unsigned ix=0; ix<nbtasklets; ix++)
+        Agenda::make_tasklet("check_tasklet", [&,ix](ItemPtr) {
+        nbrun++;
+        if (ix%2 == 0)
+            Agenda::make_tasklet("check_subtasklet", [&](ItemPtr) {
+            nbrun++;
+        }, TaskPrio::High);
+    }, (TaskPrio)(ix%nb_task_prio));
+    Agenda::drain();
+    Agenda::stop();
+    check(nbrun.load() == nbtasklets + nbtasklets/2, "the agenda ran every tasklet");
+    check(ItemVal::nb_items() == nbitems, "tasklets are not registered");
+}
+
+// the same commands, sequentially in this process and thru shard
+// processes; the big tuple gets overflow the socket buffers both ways
+static void
+check_shards(const char*program)
+{
+    std::ostringstream in;
+    for (unsigned ix=0; ix<2000; ix++)
+        in << "{\"cmd\":\"put\",\"item\":{\"item\":\"check_r" << ix%7 << "\",\"irank\":1},"
+           << "\"attr\":{\"item\":\"check_a\",\"irank\":" << ix%50 << "},\"val\":" << ix << "}\n";
+    in << "{\"cmd\":\"put\",\"item\":{\"item\":\"check_r1\",\"irank\":1},\"attr\":{\"item\":\"check_big\"},"
+       << "\"val\":{\"kind\":\"tuple\",\"comp\":[";
+    for (unsigned ix=0; ix<500; ix++)
+        in << (ix?",":"") << "{\"item\":\"check_e\",\"irank\":" << ix+1 << "}";
+    in << "]}}\n";
+    for (unsigned ix=0; ix<1000; ix++)
+        in << "{\"cmd\":\"get\",\"item\":{\"item\":\"check_r1\",\"irank\":1},\"attr\":{\"item\":\"check_big\"}}\n";
+    for (unsigned ix=0; ix<7; ix++)
+        in << "{\"cmd\":\"query\",\"item\":{\"item\":\"check_r" << ix << "\",\"irank\":1}}\n";
+    std::istringstream seqin(in.str()), shardin(in.str());
+    std::ostringstream seqout, shardout;
+    BatchPipeline::run(seqin,seqout);
+    try {
+        Shard::coordinate(shardin,shardout,3,program);
+    }
+    catch (const std::exception&ex) {
+        std::cout << "shards: " << ex.what() << std::endl;
+    }
+    check(!seqout.str().empty() && seqout.str() == shardout.str(),
+          "sharded and sequential batches give the same output");
+}
+
+// a world dumped then paged thru a tiny budget reads back the same
+static void
+check_pager(void)
+{
+    WorldParams wp;
+    wp._wnbradix = 4;
+    wp._witemsperradix = 2000;
+    std::vector<ItemPtr> items = WorldGen::generate(wp);
+    std::vector<std::string> contents;
+    Json::StreamWriterBuilder wbuild;
+    wbuild["indentation"] = "";
+    for (ItemPtr itp : items)
+        contents.push_back(Json::writeString(wbuild,itp->content_to_json()));
+    char path[] = "/tmp/iaca-check-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        check(false, "pager store created");
+        return;
+    }
+    close(fd);
+    Dumper::dump_file(path);
+    Pager::open(path, 64<<10);
+    bool same = true;
+    for (int round=0; round<2; round++)
+        for (size_t ix=0; ix<items.size(); ix++)
+            if (Json::writeString(wbuild,items[ix]->content_to_json()) != contents[ix])
+                same = false;
+    for (size_t ix=0; ix<items.size(); ix+=3)
+        items[ix]->put_attr(ItemVal::find_or_make("check_paged",1), ValuePtr(new IntVal(ix)));
+    bool kept = true;
+    for (size_t ix=0; ix<items.size(); ix+=3)
+        if (int_of(items[ix]->get_attr(ItemVal::find_or_make("check_paged",1))) != (intptr_t)ix)
+            kept = false;
+    Json::Value js = Pager::stats_json();
+    Pager::stop();
+    unlink(path);
+    check(same, "paged items read back their content");
+    check(kept, "writes to paged items are kept across evictions");
+    check(js["evictions"].asUInt64() > 0,
+          "the pager evicted " + js["evictions"].asString() + " items to keep its budget");
+}
+
+int main(int argc, char**argv)
+{
+    // the shards are run as PROGRAM --batch --shard-serve SOCKET
+    if (argc == 4 && !strcmp(argv[2],"--shard-serve")) {
+        Agenda::start(1);
+        Shard::serve(argv[3]);
+        Agenda::stop();
+        return 0;
+    }
+    try {
+        check_transactions();
+        check_agenda();
+        check_shards("/proc/self/exe");
+        check_pager();
+    }
+    catch (const std::exception&ex) {
+        std::cout << "FAIL " << ex.what() << std::endl;
+        check_failures++;
+    }
+    return check_failures;
+}
@@ -0,0 +1,209 @@
+// file iacadump.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacadump.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+
+using namespace Iaca;
+
+bool
+Dumper::dumped(const ItemVal*itm)
+{
+    return itm && !dynamic_cast<const TaskletPayload*>(itm->payload()) && Shard::owns(itm);
+}
+
+unsigned long
+Dumper::dump_items(std::ostream&out)
+{
+    IACA_TRACE_SCOPE("Dumper::dump_items");
+    Json::StreamWriterBuilder wbuild;
+    wbuild["indentation"] = "";
+    unsigned long nb = 0;
+    ItemVal::scan_all_items([&](ItemVal*itm) {
+        if (!dumped(itm)) return true;
+        out << Json::writeString(wbuild,itm->content_to_json()) << '\n';
+        nb++;
+        return true;
+    });
+    out.flush();
+    return nb;
+}
+
+unsigned long
+Dumper::dump_file(const std::string&path)
+{
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot open dump file " + path);
+    unsigned long nb = dump_items(out);
+    if (!out) throw std::runtime_error("failed to write dump file " + path);
+    return nb;
+}
+
+unsigned long
+Dumper::load_items(std::istream&in)
+{
+    IACA_TRACE_SCOPE("Dumper::load_items");
+    Json::CharReaderBuilder rbuild;
+    std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+    std::string line;
+    unsigned long nb = 0;
+    unsigned long lineno = 0;
+    while (std::getline(in,line)) {
+        lineno++;
+        if (line.empty()) continue;
+        Json::Value js;
+        std::string errs;
+        if (!reader->parse(line.data(),line.data()+line.size(),&js,&errs))
+            throw std::runtime_error("bad JSON at line " + std::to_string(lineno)
+                                     + " of dump: " + errs);
+        ItemPtr itp = ItemPtr::from_json(js);
+        if (!itp)
+            throw std::runtime_error("bad item at line " + std::to_string(lineno)
+                                     + " of dump");
+        itp->content_from_json(js);
+        nb++;
+    }
+    return nb;
+}
+
+unsigned long
+Dumper::load_file(const std::string&path)
+{
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open dump file " + path);
+    return load_items(in);
+}
+
+namespace {
+// shared by the shard tasklets, which may outlive the export call
+struct ShardState {
+    std::vector<ItemVal*> _sitems;
+    std::vector<std::string> _sbufs;
+    std::vector<bool> _sdone;
+    std::exception_ptr _serror;	// the first failure, rethrown by the waiter
+    std::mutex _smtx;
+    std::condition_variable _scond;
+    void serialize(unsigned shix, unsigned nbshards) {
+        IACA_TRACE_SCOPE("Dumper::serialize_shard");
+        std::string buf;
+        std::exception_ptr err;
+        try {
+            Json::StreamWriterBuilder wbuild;
+            wbuild["indentation"] = "";
+            size_t lo = _sitems.size()*shix/nbshards;
+            size_t hi = _sitems.size()*(shix+1)/nbshards;
+            for (size_t ix=lo; ix<hi; ix++) {
+                buf += Json::writeString(wbuild,_sitems[ix]->content_to_json());
+                buf += '\n';
+            }
+        }
+        catch (...) {
+            err = std::current_exception();
+        }
+        std::lock_guard<std::mutex> gu(_smtx);
+        _sbufs[shix].swap(buf);
+        if (err && !_serror) _serror = err;
+        _sdone[shix] = true;
+        _scond.notify_all();
+    };
+};
+};
+
+// the items are split in contiguous ranges of the dump order, so
+// concatenating the shards gives exactly the sequential dump
+unsigned long
+Dumper::serialize_shards(unsigned nbshards,
+                         std::function<void(unsigned,const std::string&)> shardfun)
+{
+    IACA_TRACE_SCOPE("Dumper::serialize_shards");
+    auto state = std::make_shared<ShardState>();
+    ItemVal::scan_all_items([&](ItemVal*itm) {
+        if (dumped(itm)) state->_sitems.push_back(itm);
+        return true;
+    });
+    bool ownagenda = false;
+    if (Agenda::nb_workers() == 0) {
+        Agenda::start(std::thread::hardware_concurrency());
+        ownagenda = true;
+    }
+    if (nbshards == 0) nbshards = 4*Agenda::nb_workers();
+    nbshards = std::max(1UL, std::min((unsigned long)nbshards, (unsigned long)state->_sitems.size()));
+    state->_sbufs.resize(nbshards);
+    state->_sdone.resize(nbshards,false);
+    // a worker waiting for other tasklets could starve the agenda
+    bool inworker = Agenda::current_worker() >= 0;
+    for (unsigned shix=0; shix<nbshards; shix++) {
+        if (inworker)
+            state->serialize(shix,nbshards);
+        else
+            Agenda::make_tasklet("export_shard", [=](ItemPtr) {
+                state->serialize(shix,nbshards);
+            }, TaskPrio::High);
+    }
+    try {
+        for (unsigned shix=0; shix<nbshards; shix++) {
+            std::string buf;
+            {
+                std::unique_lock<std::mutex> lk(state->_smtx);
+                state->_scond.wait(lk, [&] {
+                    return (bool)state->_sdone[shix];
+                });
+                if (state->_serror) std::rethrow_exception(state->_serror);
+                buf.swap(state->_sbufs[shix]);
+            }
+            shardfun(shix,buf);
+        }
+    }
+    catch (...) {
+        if (ownagenda) Agenda::stop();
+        throw;
+    }
+    if (ownagenda) Agenda::stop();
+    return state->_sitems.size();
+}
+
+unsigned long
+Dumper::parallel_dump_items(std::ostream&out, unsigned nbshards)
+{
+    unsigned long nb = serialize_shards(nbshards,[&](unsigned, const std::string&buf) {
+        out << buf;
+    });
+    out.flush();
+    return nb;
+}
+
+unsigned long
+Dumper::parallel_dump_file(const std::string&path, unsigned nbshards)
+{
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot open dump file " + path);
+    unsigned long nb = parallel_dump_items(out,nbshards);
+    if (!out) throw std::runtime_error("failed to write dump file " + path);
+    return nb;
+}
+
+unsigned long
+Dumper::parallel_dump_shards(const std::string&prefix, unsigned nbshards)
+{
+    return serialize_shards(nbshards,[&](unsigned shix, const std::string&buf) {
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "-%05u.jsonl", shix);
+        std::string path = prefix + suffix;
+        std::ofstream out(path);
+        out << buf;
+        if (!out) throw std::runtime_error("failed to write dump shard " + path);
+    });
+}
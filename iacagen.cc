@@ -0,0 +1,116 @@
+// file iacagen.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacagen.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+
+using namespace Iaca;
+
+bool
+WorldParams::parse(const QString&spec)
+{
+    for (const QString&kv : spec.split(',')) {
+        if (kv.isEmpty()) continue;
+        QStringList kvl = kv.split('=');
+        if (kvl.size() != 2) return false;
+        const QString&key = kvl[0];
+        bool ok = false;
+        if (key == "radix") _wnbradix = kvl[1].toUInt(&ok);
+        else if (key == "items") _witemsperradix = kvl[1].toUInt(&ok);
+        else if (key == "fanout") _wfanout = kvl[1].toUInt(&ok);
+        else if (key == "tuple") _wtuplesize = kvl[1].toDouble(&ok);
+        else if (key == "set") _wsetsize = kvl[1].toDouble(&ok);
+        else if (key == "shared") _wsharedratio = kvl[1].toDouble(&ok);
+        else if (key == "seed") _wseed = kvl[1].toUInt(&ok);
+        if (!ok) return false;
+    }
+    return _wnbradix > 0 && _witemsperradix > 0
+           && _wtuplesize >= 0.0 && _wsetsize >= 0.0
+           && _wsharedratio >= 0.0 && _wsharedratio <= 1.0;
+}
+
+Json::Value
+WorldParams::to_json(void) const
+{
+    Json::Value js {Json::objectValue};
+    js["radix"] = _wnbradix;
+    js["items"] = _witemsperradix;
+    js["fanout"] = _wfanout;
+    js["tuple"] = _wtuplesize;
+    js["set"] = _wsetsize;
+    js["shared"] = _wsharedratio;
+    js["seed"] = _wseed;
+    return js;
+}
+
+std::vector<ItemPtr>
+WorldGen::generate(const WorldParams&wp)
+{
+    std::mt19937 rand(wp._wseed);
+    std::uniform_real_distribution<double> unif(0.0,1.0);
+    // a Poisson distribution needs a positive mean, 0 gives empty sequences
+    std::poisson_distribution<unsigned> tuplesize(wp._wtuplesize > 0.0 ? wp._wtuplesize : 1.0);
+    std::poisson_distribution<unsigned> setsize(wp._wsetsize > 0.0 ? wp._wsetsize : 1.0);
+    std::vector<ItemPtr> items;
+    items.reserve((size_t)wp._wnbradix*wp._witemsperradix);
+    for (unsigned rix=0; rix<wp._wnbradix; rix++) {
+        QString radix = QString("w") + QString::number(rix);
+        for (unsigned ix=0; ix<wp._witemsperradix; ix++)
+            items.push_back(ItemVal::make(radix));
+    }
+    unsigned nbattrs = std::max(4*wp._wfanout, 16u);
+    std::vector<ItemPtr> attrs;
+    for (unsigned ix=0; ix<nbattrs; ix++)
+        attrs.push_back(ItemVal::make("attr"));
+    // a bounded pool of values, reused according to the shared ratio
+    const unsigned maxshared = 4096;
+    std::vector<ValuePtr> shared;
+    auto random_item = [&](void) {
+        return items[rand()%items.size()];
+    };
+    auto fresh_value = [&](void) -> ValuePtr {
+        unsigned r = rand()%100;
+        if (r < 25)
+            return ValuePtr(new IntVal(rand()%1000000));
+        if (r < 40)
+            return ValuePtr(StrVal::make(QString("s") + QString::number(rand()%100000)));
+        if (r < 70) {
+            std::vector<ItemPtr> vec(wp._wtuplesize > 0.0 ? tuplesize(rand) : 0);
+            for (ItemPtr&itp : vec) itp = random_item();
+            return ValuePtr(const_cast<TupleVal*>(TupleVal::make(vec)));
+        }
+        if (r < 90) {
+            std::vector<ItemPtr> vec(wp._wsetsize > 0.0 ? setsize(rand) : 0);
+            for (ItemPtr&itp : vec) itp = random_item();
+            return ValuePtr(const_cast<SetVal*>(SetVal::make(vec)));
+        }
+        return random_item();
+    };
+    for (ItemPtr itp : items) {
+        for (unsigned fx=0; fx<wp._wfanout; fx++) {
+            ValuePtr val;
+            if (!shared.empty() && unif(rand) < wp._wsharedratio)
+                val = shared[rand()%shared.size()];
+            else {
+                val = fresh_value();
+                if (shared.size() < maxshared) shared.push_back(val);
+                else shared[rand()%maxshared] = val;
+            }
+            itp->put_attr(attrs[rand()%nbattrs],val);
+        }
+    }
+    return items;
+}
@@ -0,0 +1,168 @@
+// file iacagenda.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacagenda.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <iostream>
+
+using namespace Iaca;
+
+std::vector<std::unique_ptr<Agenda::Worker>> Agenda::_workers_;
+thread_local int Agenda::_curworkix_ = -1;
+std::mutex Agenda::_agmtx_;
+std::condition_variable Agenda::_agcond_;
+std::condition_variable Agenda::_drain_cond_;
+std::atomic<long> Agenda::_nbqueued_;
+std::atomic<long> Agenda::_nbpending_;
+std::atomic<unsigned> Agenda::_addcount_;
+std::atomic<bool> Agenda::_stopping_;
+
+void
+Agenda::add_tasklet(ItemPtr itp, TaskPrio prio)
+{
+    if (!itp) return;
+    if (!dynamic_cast<TaskletPayload*>(itp->payload()))
+        throw std::runtime_error("agenda: item without tasklet payload");
+    if (_workers_.empty())
+        throw std::runtime_error("agenda: not started");
+    unsigned pix = (unsigned)prio;
+    assert (pix < nb_task_prio);
+    unsigned wix = (_curworkix_>=0)
+                   ? (unsigned)_curworkix_
+                   : (_addcount_++ % _workers_.size());
+    Worker*w = _workers_[wix].get();
+    _nbpending_++;
+    {
+        std::lock_guard<std::mutex> gu(w->_wmtx);
+        w->_wdeque[pix].push_back(itp);
+    }
+    {
+        std::lock_guard<std::mutex> gu(_agmtx_);
+        _nbqueued_++;
+    }
+    _agcond_.notify_one();
+}
+
+ItemPtr
+Agenda::make_tasklet(const QString&radix, const TaskletFun&fun, TaskPrio prio)
+{
+    ItemPtr itp = ItemVal::make_transient(radix);
+    if (!itp) throw std::runtime_error("agenda: invalid tasklet radix");
+    itp->put_payload(new TaskletPayload(itp.get(),fun));
+    add_tasklet(itp,prio);
+    return itp;
+}
+
+// for each priority, from the highest: our own deque from its back,
+// then the deques of other workers from their front
+ItemPtr
+Agenda::pop_tasklet(unsigned wix)
+{
+    unsigned nbw = _workers_.size();
+    for (int pix=(int)nb_task_prio-1; pix>=0; pix--) {
+        for (unsigned cnt=0; cnt<nbw; cnt++) {
+            Worker*w = _workers_[(wix+cnt)%nbw].get();
+            std::lock_guard<std::mutex> gu(w->_wmtx);
+            auto&dq = w->_wdeque[pix];
+            if (dq.empty()) continue;
+            ItemPtr itp;
+            if (cnt==0) {
+                itp = dq.back();
+                dq.pop_back();
+            }
+            else {
+                itp = dq.front();
+                dq.pop_front();
+            }
+            _nbqueued_--;
+            return itp;
+        }
+    }
+    return nullptr;
+}
+
+void
+Agenda::run_tasklet(ItemPtr itp)
+{
+    IACA_TRACE_SCOPE("Agenda::run_tasklet");
+    auto tpy = dynamic_cast<TaskletPayload*>(itp->payload());
+    try {
+        if (tpy) tpy->run(itp);
+    }
+    catch (const std::exception&ex) {
+        std::cerr << "iaca: tasklet " << itp->radix()->val().toStdString()
+                  << "_" << itp->rank() << " failed: " << ex.what() << std::endl;
+    }
+    if (--_nbpending_ == 0) {
+        std::lock_guard<std::mutex> gu(_agmtx_);
+        _drain_cond_.notify_all();
+    }
+}
+
+void
+Agenda::work_loop(unsigned wix)
+{
+    _curworkix_ = wix;
+    for (;;) {
+        ItemPtr itp = pop_tasklet(wix);
+        if (itp) {
+            run_tasklet(itp);
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(_agmtx_);
+        _agcond_.wait(lk, [] {
+            return _stopping_.load() || _nbqueued_.load()>0;
+        });
+        if (_stopping_.load()) return;
+    }
+}
+
+void
+Agenda::start(unsigned nbworkers)
+{
+    if (!_workers_.empty())
+        throw std::runtime_error("agenda: already started");
+    if (nbworkers==0) nbworkers = 1;
+    _stopping_.store(false);
+    for (unsigned wix=0; wix<nbworkers; wix++)
+        _workers_.emplace_back(new Worker);
+    for (unsigned wix=0; wix<nbworkers; wix++)
+        _workers_[wix]->_wthread = std::thread(work_loop,wix);
+}
+
+void
+Agenda::drain(void)
+{
+    std::unique_lock<std::mutex> lk(_agmtx_);
+    _drain_cond_.wait(lk, [] {
+        return _nbpending_.load()==0;
+    });
+}
+
+void
+Agenda::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> gu(_agmtx_);
+        _stopping_.store(true);
+    }
+    _agcond_.notify_all();
+    for (auto&w : _workers_)
+        if (w->_wthread.joinable()) w->_wthread.join();
+    _workers_.clear();
+    _nbqueued_.store(0);
+    _nbpending_.store(0);
+}
@@ -20,6 +20,8 @@
 using namespace Iaca;
 
 std::map<QString,std::shared_ptr<StrVal>> ItemVal::_radix_dict_;
+std::map<const StrVal*,std::map<uint64_t,ItemPtr>> ItemVal::_radix_items_;
+std::recursive_mutex ItemVal::_radix_mtx_;
 
 bool
 ItemVal::valid_radix(const QString&qs) {
@@ -43,7 +45,9 @@ ItemVal::valid_radix(const QString&qs) {
 
 const StrVal*
 ItemVal::register_radix(const QString&qs) {
+    IACA_TRACE_SCOPE("ItemVal::register_radix");
     if (!valid_radix(qs)) return nullptr;
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
     auto it = _radix_dict_.find(qs);
     if (it != _radix_dict_.end())
         return it->second.get();
@@ -55,9 +59,185 @@ ItemVal::register_radix(const QString&qs) {
 const StrVal*
 ItemVal::find_radix(const QString&qs) {
     if (!valid_radix(qs)) return nullptr;
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
     auto it = _radix_dict_.find(qs);
     if (it != _radix_dict_.end())
         return it->second.get();
     return nullptr;
 }
 
+ItemPtr
+ItemVal::make(const QString&qs) {
+    IACA_TRACE_SCOPE("ItemVal::make");
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    const StrVal*rad = register_radix(qs);
+    if (!rad) return nullptr;
+    auto&items = _radix_items_[rad];
+    uint64_t rk = items.empty() ? 1 : items.rbegin()->first + 1;
+    ItemPtr itp(new ItemVal(_radix_dict_[rad->val()],rk));
+    items.emplace_hint(items.end(),rk,itp);
+    return itp;
+}
+
+ItemPtr
+ItemVal::make_transient(const QString&qs) {
+    static std::atomic<uint64_t> count;
+    const StrVal*rad = register_radix(qs);
+    if (!rad) return nullptr;
+    std::shared_ptr<StrVal> pradix;
+    {
+        std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+        pradix = _radix_dict_[rad->val()];
+    }
+    return ItemPtr(new ItemVal(pradix, transient_rank | ++count));
+}
+
+ItemPtr
+ItemVal::find(const QString&qs, uint64_t rk) {
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    const StrVal*rad = find_radix(qs);
+    if (!rad) return nullptr;
+    auto rit = _radix_items_.find(rad);
+    if (rit == _radix_items_.end()) return nullptr;
+    auto it = rit->second.find(rk);
+    if (it == rit->second.end()) return nullptr;
+    return it->second;
+}
+
+ItemPtr
+ItemVal::find_or_make(const QString&qs, uint64_t rk) {
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    const StrVal*rad = register_radix(qs);
+    if (!rad) return nullptr;
+    auto&items = _radix_items_[rad];
+    auto it = items.find(rk);
+    if (it != items.end()) return it->second;
+    ItemPtr itp(new ItemVal(_radix_dict_[rad->val()],rk));
+    items.emplace(rk,itp);
+    return itp;
+}
+
+unsigned long
+ItemVal::nb_items(void) {
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    unsigned long nb = 0;
+    for (auto&ri : _radix_items_) nb += ri.second.size();
+    return nb;
+}
+
+// the registry is ordered by radix address, so sort the radixes by
+// name; the items are copied first so that the function runs without
+// the registry lock, and may lock items
+void
+ItemVal::scan_all_items(std::function<bool(ItemVal*)> scanfun) {
+    std::vector<ItemVal*> items;
+    {
+        std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+        for (auto&rd : _radix_dict_) {
+            auto rit = _radix_items_.find(rd.second.get());
+            if (rit == _radix_items_.end()) continue;
+            for (auto&it : rit->second)
+                items.push_back(it.second.get());
+        }
+    }
+    for (ItemVal*itm : items)
+        if (!scanfun(itm)) return;
+}
+
+std::vector<ItemVal*>
+ItemVal::items_after(const ItemVal*itm, unsigned nb) {
+    std::vector<ItemVal*> items;
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    auto rdit = itm ? _radix_dict_.find(itm->radix()->val()) : _radix_dict_.begin();
+    bool first = itm != nullptr;
+    for (; rdit != _radix_dict_.end() && items.size() < nb; rdit++) {
+        auto rit = _radix_items_.find(rdit->second.get());
+        if (rit == _radix_items_.end()) continue;
+        auto it = first ? rit->second.upper_bound(itm->rank()) : rit->second.begin();
+        first = false;
+        for (; it != rit->second.end() && items.size() < nb; it++)
+            items.push_back(it->second.get());
+    }
+    return items;
+}
+
+Json::Value
+ItemVal::content_to_json(void) const {
+    IACA_TRACE_SCOPE("ItemVal::content_to_json");
+    std::lock_guard<std::mutex> gu(_imtx);
+    Pager::touch(this);
+    return content_json_locked();
+}
+
+Json::Value
+ItemVal::content_json_locked(void) const {
+    Json::Value js = to_json();
+    Json::Value jattrs {Json::arrayValue};
+    for (auto&av : _iattrmap) {
+        Json::Value jav {Json::objectValue};
+        jav["at"] = av.first.to_json();
+        jav["va"] = av.second.to_json();
+        jattrs.append(jav);
+    }
+    js["attrs"] = jattrs;
+    return js;
+}
+
+void
+ItemVal::content_from_json(const Json::Value&js) {
+    IACA_TRACE_SCOPE("ItemVal::content_from_json");
+    std::lock_guard<std::mutex> gu(_imtx);
+    Pager::touch(this);
+    content_from_json_locked(js);
+    Pager::reestimate(this);
+    _iversion++;
+}
+
+// also used by the Pager to fault in, without changing the version
+void
+ItemVal::content_from_json_locked(const Json::Value&js) const {
+    std::map<ItemPtr,ValuePtr> attrmap;
+    for (const Json::Value&jav : js["attrs"]) {
+        ItemPtr attr = ItemPtr::from_json(jav["at"]);
+        ValuePtr val = ValuePtr::from_json(jav["va"]);
+        if (attr && val) attrmap[attr] = val;
+    }
+    _iattrmap.swap(attrmap);
+}
+
+unsigned
+ItemVal::nb_radixes(void) {
+    std::lock_guard<std::recursive_mutex> gu(_radix_mtx_);
+    return _radix_dict_.size();
+}
+
+void
+ItemVal::put_attrs(std::vector<std::pair<ItemPtr,ValuePtr>>&attrvals) {
+    IACA_TRACE_SCOPE("ItemVal::put_attrs");
+    std::stable_sort(attrvals.begin(),attrvals.end(),
+                     [](const std::pair<ItemPtr,ValuePtr>&av1,
+    const std::pair<ItemPtr,ValuePtr>&av2) {
+        return ItemPtr::less(av1.first,av2.first);
+    });
+    std::lock_guard<std::mutex> gu(_imtx);
+    Pager::touch(this);
+    auto hint = _iattrmap.begin();
+    unsigned nb = attrvals.size();
+    for (unsigned ix=0; ix<nb; ix++) {
+        ItemPtr attr = attrvals[ix].first;
+        if (!attr) continue;
+        if (ix+1<nb && ItemPtr::same(attr,attrvals[ix+1].first)) continue;
+        ValuePtr val = attrvals[ix].second;
+        if (!val) {
+            _iattrmap.erase(attr);
+            hint = _iattrmap.lower_bound(attr);
+            continue;
+        }
+        // the attributes come in order, so the hint is usually right
+        auto it = _iattrmap.emplace_hint(hint,attr,val);
+        it->second = val;
+        hint = std::next(it);
+    }
+    Pager::reestimate(this);
+    _iversion++;
+}
@@ -16,6 +16,7 @@
 //   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "iaca.hh"
+#include <iostream>
 
 using namespace Iaca;
 
@@ -24,6 +25,17 @@ bool Iaca::batch;
 int main(int argc, char**argv)
 {
     ItemPtr ip;
+    unsigned nbjobs = 0;
+    std::string loadpath, dumppath, commandpath, shardprefix, tracepath, foldedpath;
+    WorldParams worldparams;
+    bool generate = false;
+    bool showstats = false;
+    unsigned statsperiod = 0;
+    std::string pagepath;
+    unsigned pagebudgetmb = 1024;
+    unsigned nbshards = 0;
+    std::string shardsocket;
+    std::string moduledir;
     batch = false;
     std::unique_ptr<QCoreApplication> this_app;
     for (int ix=1; ix<argc && !batch; ix++)
@@ -43,9 +55,193 @@ int main(int argc, char**argv)
         parser.addOptions({
             {   {"b","batch"},
                 QCoreApplication::translate("main","Run in batch mode without GUI.")
+            },
+            {   {"j","jobs"},
+                QCoreApplication::translate("main","Number of agenda worker threads, default is the number of cores."),
+                QCoreApplication::translate("main","nbjobs")
+            },
+            {   "load",
+                QCoreApplication::translate("main","Load the items dumped in a JSON lines file."),
+                QCoreApplication::translate("main","dumpfile")
+            },
+            {   "page-store",
+                QCoreApplication::translate("main","Page the items in and out of a JSON lines dump file, written back at exit."),
+                QCoreApplication::translate("main","storefile")
+            },
+            {   "page-budget",
+                QCoreApplication::translate("main","Memory budget in megabytes for paged in attributes, default 1024."),
+                QCoreApplication::translate("main","megabytes")
+            },
+            {   "generate",
+                QCoreApplication::translate("main","Generate a synthetic world, e.g. radix=100,items=1000,fanout=4,tuple=8,set=8,shared=0.1,seed=1"),
+                QCoreApplication::translate("main","worldspec")
+            },
+            {   "commands",
+                QCoreApplication::translate("main","In batch mode, apply the JSON lines commands of a file, or of stdin for -."),
+                QCoreApplication::translate("main","commandfile")
+            },
+            {   "shards",
+                QCoreApplication::translate("main","In batch mode, spread the items over that many shard processes routing the commands to them."),
+                QCoreApplication::translate("main","nbshards")
+            },
+            {   "shard-serve",
+                QCoreApplication::translate("main","In batch mode, serve one shard on a Unix socket, as spawned by --shards."),
+                QCoreApplication::translate("main","socket")
+            },
+            {   "module-cache",
+                QCoreApplication::translate("main","Directory caching the compiled modules, default $IACA_MODULE_DIR or ~/.cache/iaca/modules."),
+                QCoreApplication::translate("main","directory")
+            },
+            {   "dump",
+                QCoreApplication::translate("main","Dump all items into a JSON lines file at exit."),
+                QCoreApplication::translate("main","dumpfile")
+            },
+            {   "dump-shards",
+                QCoreApplication::translate("main","Dump all items at exit into shard files prefix-00000.jsonl, ..."),
+                QCoreApplication::translate("main","prefix")
+            },
+            {   "stats",
+                QCoreApplication::translate("main","Print value counters and a heap census as JSON to stderr at exit.")
+            },
+            {   "stats-period",
+                QCoreApplication::translate("main","In batch mode, print the value counters to stderr every few seconds."),
+                QCoreApplication::translate("main","seconds")
+            },
+            {   "trace",
+                QCoreApplication::translate("main","Enable the tracing timers, and write them as Chrome trace events at exit."),
+                QCoreApplication::translate("main","tracefile")
+            },
+            {   "trace-folded",
+                QCoreApplication::translate("main","Enable the tracing timers, and write them as folded stacks for flamegraphs at exit."),
+                QCoreApplication::translate("main","foldedfile")
             }
         });
         parser.process(*this_app);
+        if (parser.isSet("jobs"))
+            nbjobs = parser.value("jobs").toUInt();
+        if (parser.isSet("load"))
+            loadpath = parser.value("load").toStdString();
+        if (parser.isSet("page-store"))
+            pagepath = parser.value("page-store").toStdString();
+        if (parser.isSet("page-budget"))
+            pagebudgetmb = parser.value("page-budget").toUInt();
+        if (parser.isSet("generate") && !worldparams.parse(parser.value("generate"))) {
+            std::cerr << argv[0] << ": bad world spec " << parser.value("generate").toStdString() << std::endl;
+            return 2;
+        }
+        generate = parser.isSet("generate");
+        if (parser.isSet("commands"))
+            commandpath = parser.value("commands").toStdString();
+        if (parser.isSet("shards"))
+            nbshards = parser.value("shards").toUInt();
+        if (parser.isSet("shard-serve"))
+            shardsocket = parser.value("shard-serve").toStdString();
+        if (parser.isSet("module-cache"))
+            moduledir = parser.value("module-cache").toStdString();
+        if (parser.isSet("dump"))
+            dumppath = parser.value("dump").toStdString();
+        if (parser.isSet("dump-shards"))
+            shardprefix = parser.value("dump-shards").toStdString();
+        showstats = parser.isSet("stats");
+        if (parser.isSet("stats-period"))
+            statsperiod = parser.value("stats-period").toUInt();
+        if (parser.isSet("trace"))
+            tracepath = parser.value("trace").toStdString();
+        if (parser.isSet("trace-folded"))
+            foldedpath = parser.value("trace-folded").toStdString();
     }
-    return this_app->exec();
+    if (!tracepath.empty() || !foldedpath.empty()) {
+#ifndef IACA_TRACING
+        std::cerr << argv[0] << ": tracing was compiled out" << std::endl;
+#endif
+        Trace::enable(true);
+    }
+    int res = 0;
+    // a bad load or page store, or a dead shard, is an error not a crash
+    try {
+        if (!moduledir.empty())
+            Module::set_cache_dir(moduledir);
+        if (!loadpath.empty())
+            Dumper::load_file(loadpath);
+        if (!pagepath.empty())
+            Pager::open(pagepath,(size_t)pagebudgetmb<<20);
+        if (generate)
+            WorldGen::generate(worldparams);
+        if (nbjobs == 0)
+            nbjobs = std::thread::hardware_concurrency();
+        Agenda::start(nbjobs);
+        if (batch) {
+            Stats::start_periodic(statsperiod);
+            std::ifstream cmdin;
+            if (!commandpath.empty() && commandpath != "-") {
+                cmdin.open(commandpath);
+                if (!cmdin) {
+                    std::cerr << argv[0] << ": cannot open commands " << commandpath << std::endl;
+                    res = 1;
+                }
+            }
+            if (!shardsocket.empty())
+                Shard::serve(shardsocket);
+            else if (!commandpath.empty() && res == 0) {
+                std::istream&cmds = (commandpath == "-") ? std::cin : cmdin;
+                if (nbshards > 0)
+                    Shard::coordinate(cmds,std::cout,nbshards,
+                                      QCoreApplication::applicationFilePath().toStdString());
+                else
+                    BatchPipeline::run(cmds,std::cout);
+            }
+            Agenda::drain();
+            Stats::stop_periodic();
+        }
+        else {
+            ItemModel model;
+            QTreeView view;
+            view.setModel(&model);
+            view.setUniformRowHeights(true);
+            view.show();
+            res = this_app->exec();
+        }
+        if (!dumppath.empty())
+            Dumper::parallel_dump_file(dumppath);
+        if (!shardprefix.empty())
+            Dumper::parallel_dump_shards(shardprefix);
+        Agenda::stop();
+        Pager::sync();
+        if (showstats) {
+            Json::Value js {Json::objectValue};
+            js["counters"] = Stats::counters_json();
+            js["census"] = Stats::census_json();
+            if (Pager::is_open())
+                js["pager"] = Pager::stats_json();
+            if (Module::nb_compiled() + Module::nb_cached() > 0) {
+                js["modules"]["compiled"] = (Json::UInt64)Module::nb_compiled();
+                js["modules"]["cached"] = (Json::UInt64)Module::nb_cached();
+            }
+            Json::StreamWriterBuilder wbuild;
+            wbuild["indentation"] = " ";
+            // stdout carries the batch command output
+            std::cerr << Json::writeString(wbuild,js) << std::endl;
+        }
+        Pager::stop();
+    }
+    catch (const std::exception&ex) {
+        std::cerr << argv[0] << ": " << ex.what() << std::endl;
+        Stats::stop_periodic();
+        Agenda::stop();
+        try {
+            Pager::stop();
+        }
+        catch (const std::exception&) {
+        }
+        return 1;
+    }
+    if (!tracepath.empty()) {
+        std::ofstream out(tracepath);
+        Trace::write_chrome_trace(out);
+    }
+    if (!foldedpath.empty()) {
+        std::ofstream out(foldedpath);
+        Trace::write_folded_stacks(out);
+    }
+    return res;
 }
@@ -0,0 +1,372 @@
+// file iacamodel.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacamodel.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+
+using namespace Iaca;
+
+// items are never freed, so values may alias them without owning
+static ValuePtr
+alias_item(ItemVal*itm)
+{
+    return ValuePtr(std::shared_ptr<Value>(), itm);
+}
+
+QString
+ItemModel::item_name(const ItemVal*itm)
+{
+    if (!itm) return QString("~");
+    QString name = itm->radix()->val();
+    if (itm->rank() > 0)
+        name.append("_").append(QString::number((unsigned long long)itm->rank()));
+    return name;
+}
+
+QString
+ItemModel::summary(const Value*val)
+{
+    const unsigned maxcomp = 8;
+    const int maxlen = 80;
+    if (!val) return QString("~");
+    switch (val->kind()) {
+    case ValKind::Nil:
+        break;
+    case ValKind::Int:
+        return QString::number((long long)static_cast<const IntVal*>(val)->val());
+    case ValKind::Dbl:
+        return QString::number(static_cast<const DblVal*>(val)->val());
+    case ValKind::Str: {
+        const QString&str = static_cast<const StrVal*>(val)->val();
+        if (str.size() <= maxlen) return QString("\"") + str + QString("\"");
+        return QString("\"") + str.left(maxlen) + QString("\"...");
+    }
+    case ValKind::Item: {
+        auto itm = static_cast<const ItemVal*>(val);
+        return item_name(itm) + QString(" (")
+               + QString::number(itm->nb_attrs()) + QString(" attrs)");
+    }
+    case ValKind::Tuple:
+    case ValKind::Set: {
+        auto seq = static_cast<const SeqItemsVal*>(val);
+        bool istuple = val->kind() == ValKind::Tuple;
+        QString res = QString(istuple?"tuple[":"set{") + QString::number(seq->size())
+                      + QString(istuple?"] ":"} ");
+        unsigned nb = std::min(seq->size(),maxcomp);
+        for (unsigned ix=0; ix<nb; ix++) {
+            if (ix>0) res.append(" ");
+            res.append(item_name(seq->unsafe_at(ix)));
+        }
+        if (nb < seq->size()) res.append(" ...");
+        return res;
+    }
+    }
+    return QString("?");
+}
+
+ItemModel::ItemModel(ValuePtr root, QObject*parent)
+    : QAbstractItemModel(parent),
+      _mroot(), _mgen(0), _mcache(cache_size),
+      _mjobmtx(), _mjobcond(), _mtodojobs(), _mdonejobs(), _mnbrunning(0),
+      _mrendering(false), _mpending()
+{
+    _mroot.reset(new Node {nullptr, 0, QString(), root, false, false, {}, {}});
+    connect(this, &ItemModel::rendered, this, &ItemModel::apply_rendered,
+            Qt::QueuedConnection);
+}
+
+ItemModel::~ItemModel()
+{
+    wait_renders();
+}
+
+// the render tasklets refer to the nodes, so wait for them
+void
+ItemModel::wait_renders(void)
+{
+    std::unique_lock<std::mutex> lk(_mjobmtx);
+    _mjobcond.wait(lk, [&] {
+        return _mnbrunning == 0 && !_mrendering;
+    });
+    _mdonejobs.clear();
+    _mpending.clear();
+}
+
+void
+ItemModel::set_root(ValuePtr root)
+{
+    beginResetModel();
+    wait_renders();
+    _mgen++;
+    _mroot.reset(new Node {nullptr, 0, QString(), root, false, false, {}, {}});
+    _mcache.clear();
+    endResetModel();
+}
+
+QModelIndex
+ItemModel::index(int row, int column, const QModelIndex&parent) const
+{
+    Node*nd = node_of(parent);
+    if (row < 0 || column < 0 || column >= 2 || row >= (int)nd->_nchildren.size())
+        return QModelIndex();
+    return createIndex(row,column,nd->_nchildren[row].get());
+}
+
+QModelIndex
+ItemModel::parent(const QModelIndex&idx) const
+{
+    if (!idx.isValid()) return QModelIndex();
+    return index_of(static_cast<Node*>(idx.internalPointer())->_nparent);
+}
+
+int
+ItemModel::rowCount(const QModelIndex&parent) const
+{
+    if (parent.column() > 0) return 0;
+    return node_of(parent)->_nchildren.size();
+}
+
+int
+ItemModel::columnCount(const QModelIndex&) const
+{
+    return 2;
+}
+
+// cheap, without listing or faulting anything
+bool
+ItemModel::hasChildren(const QModelIndex&parent) const
+{
+    if (parent.column() > 0) return false;
+    Node*nd = node_of(parent);
+    switch (nd->_nval.kind()) {
+    case ValKind::Nil:
+        return nd == _mroot.get();
+    case ValKind::Item:
+        return true;
+    case ValKind::Tuple:
+    case ValKind::Set:
+        return static_cast<const SeqItemsVal*>(nd->_nval.get())->size() > 0;
+    default:
+        return false;
+    }
+}
+
+// an item is not listed here but by the renderer, which inserts its
+// first rows once done
+bool
+ItemModel::canFetchMore(const QModelIndex&parent) const
+{
+    if (parent.column() > 0) return false;
+    Node*nd = node_of(parent);
+    switch (nd->_nval.kind()) {
+    case ValKind::Nil:
+        return nd == _mroot.get() && !nd->_nlisted;
+    case ValKind::Item:
+        if (!nd->_nlisted) return !nd->_nlisting;
+        return nd->_nchildren.size() < nd->_nattrs.size();
+    case ValKind::Tuple:
+    case ValKind::Set:
+        return nd->_nchildren.size() < static_cast<const SeqItemsVal*>(nd->_nval.get())->size();
+    default:
+        return false;
+    }
+}
+
+// one chunk of rows at most, each step costs no more than its size
+void
+ItemModel::fetchMore(const QModelIndex&parent)
+{
+    Node*nd = node_of(parent);
+    size_t first = nd->_nchildren.size();
+    std::vector<std::pair<QString,ValuePtr>> rows;
+    switch (nd->_nval.kind()) {
+    case ValKind::Nil: {
+        if (nd != _mroot.get() || nd->_nlisted) return;
+        const ItemVal*last = first>0
+                             ? static_cast<const ItemVal*>(nd->_nchildren.back()->_nval.get()) : nullptr;
+        std::vector<ItemVal*> items = ItemVal::items_after(last, fetch_chunk);
+        if (items.size() < (size_t)fetch_chunk) nd->_nlisted = true;
+        for (ItemVal*itm : items)
+            rows.emplace_back(item_name(itm), alias_item(itm));
+    }
+    break;
+    case ValKind::Item:
+        if (!nd->_nlisted) {
+            if (nd->_nlisting) return;
+            nd->_nlisting = true;
+            queue_job(RenderJob {_mgen, nd, 0, -1, {}, {}, nd->_nval, {}});
+            return;
+        }
+        for (size_t row=first; row<nd->_nattrs.size() && rows.size()<(size_t)fetch_chunk; row++)
+            rows.emplace_back(item_name(nd->_nattrs[row].first.get()), nd->_nattrs[row].second);
+        break;
+    case ValKind::Tuple:
+    case ValKind::Set: {
+        auto seq = static_cast<const SeqItemsVal*>(nd->_nval.get());
+        for (size_t row=first; row<seq->size() && rows.size()<(size_t)fetch_chunk; row++)
+            rows.emplace_back(QString("#") + QString::number((unsigned)row), alias_item(seq->unsafe_at(row)));
+    }
+    break;
+    default:
+        return;
+    }
+    insert_rows(nd,rows);
+}
+
+void
+ItemModel::insert_rows(Node*nd, std::vector<std::pair<QString,ValuePtr>>&rows)
+{
+    if (rows.empty()) return;
+    int first = nd->_nchildren.size();
+    int last = first + rows.size() - 1;
+    beginInsertRows(index_of(nd),first,last);
+    for (auto&r : rows) {
+        int row = nd->_nchildren.size();
+        nd->_nchildren.emplace_back(new Node {nd, row, r.first, r.second, false, false, {}, {}});
+    }
+    endInsertRows();
+    render_rows(nd,first,last);
+}
+
+// queue the rendering of the summaries of rows first..last of parent;
+// one agenda tasklet renders the queued jobs while there are some
+void
+ItemModel::render_rows(Node*parent, int first, int last) const
+{
+    RenderJob job {_mgen, parent, first, last, {}, {}, nullptr, {}};
+    for (int row=first; row<=last; row++)
+        job._jvals.push_back(parent->_nchildren[row]->_nval);
+    queue_job(std::move(job));
+}
+
+void
+ItemModel::queue_job(RenderJob&&job) const
+{
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> gu(_mjobmtx);
+        for (ValuePtr v : job._jvals)
+            if (v) _mpending.insert(v.get());
+        _mtodojobs.push_back(std::move(job));
+        _mnbrunning++;
+        start = !_mrendering;
+        _mrendering = true;
+    }
+    if (!start) return;
+    auto self = const_cast<ItemModel*>(this);
+    if (Agenda::nb_workers() > 0)
+        Agenda::make_tasklet("render_rows", [=](ItemPtr) {
+        self->render_queued();
+    }, TaskPrio::Urgent);
+    else
+        self->render_queued();
+}
+
+// in the renderer tasklet, till the queue is empty
+void
+ItemModel::render_queued(void)
+{
+    std::unique_lock<std::mutex> lk(_mjobmtx);
+    while (!_mtodojobs.empty()) {
+        RenderJob j = std::move(_mtodojobs.front());
+        _mtodojobs.pop_front();
+        lk.unlock();
+        if (j._jitem) {
+            // a failure leaves the item without rows
+            try {
+                static_cast<const ItemVal*>(j._jitem.get())->scan_attrs([&](ItemPtr at, ValuePtr va) {
+                    j._jattrs.emplace_back(at,va);
+                    return true;
+                });
+            }
+            catch (const std::exception&) {
+                j._jattrs.clear();
+            }
+        }
+        for (ValuePtr v : j._jvals) {
+            // a failure, e.g. of the page store, must not stop the renderer
+            try {
+                j._jtexts.push_back(summary(v.get()));
+            }
+            catch (const std::exception&ex) {
+                j._jtexts.push_back(QString("?") + QString(ex.what()));
+            }
+        }
+        lk.lock();
+        _mdonejobs.push_back(std::move(j));
+        _mnbrunning--;
+        emit rendered();
+    }
+    _mrendering = false;
+    _mjobcond.notify_all();
+}
+
+// in the GUI thread, thru a queued connection
+void
+ItemModel::apply_rendered(void)
+{
+    std::vector<RenderJob> jobs;
+    {
+        std::lock_guard<std::mutex> gu(_mjobmtx);
+        jobs.swap(_mdonejobs);
+        for (RenderJob&j : jobs)
+            for (ValuePtr v : j._jvals) _mpending.erase(v.get());
+    }
+    for (RenderJob&j : jobs) {
+        if (j._jgen != _mgen) continue;
+        if (j._jitem) {
+            j._jparent->_nattrs.swap(j._jattrs);
+            j._jparent->_nlisted = true;
+            j._jparent->_nlisting = false;
+            fetchMore(index_of(j._jparent));
+            continue;
+        }
+        for (unsigned ix=0; ix<j._jvals.size(); ix++)
+            if (j._jvals[ix])
+                _mcache.insert(j._jvals[ix].get(), new QString(j._jtexts[ix]));
+        QModelIndex pidx = index_of(j._jparent);
+        emit dataChanged(index(j._jfirst,1,pidx), index(j._jlast,1,pidx));
+    }
+}
+
+QVariant
+ItemModel::data(const QModelIndex&idx, int role) const
+{
+    if (!idx.isValid() || (role != Qt::DisplayRole && role != Qt::ToolTipRole))
+        return QVariant();
+    Node*nd = static_cast<Node*>(idx.internalPointer());
+    if (idx.column() == 0) return nd->_nlabel;
+    const Value*v = nd->_nval.get();
+    if (!v) return QString("~");
+    if (QString*cached = _mcache.object(v))
+        return *cached;
+    // evicted from the cache, render it again unless already under way
+    bool pending;
+    {
+        std::lock_guard<std::mutex> gu(_mjobmtx);
+        pending = _mpending.count(v) > 0;
+    }
+    if (!pending)
+        render_rows(nd->_nparent,nd->_nrow,nd->_nrow);
+    return QString("...");
+}
+
+QVariant
+ItemModel::headerData(int section, Qt::Orientation orient, int role) const
+{
+    if (orient != Qt::Horizontal || role != Qt::DisplayRole) return QVariant();
+    return section == 0 ? QString("attribute") : QString("value");
+}
@@ -0,0 +1,250 @@
+// file iacamodule.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacamodule.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <sstream>
+#include <cstdio>
+#include <unistd.h>
+#include <dlfcn.h>
+
+// the Makefile gives how the sources of iaca were compiled
+#ifndef IACA_MODULE_CXX
+#define IACA_MODULE_CXX "g++"
+#endif
+#ifndef IACA_MODULE_FLAGS
+#define IACA_MODULE_FLAGS "-std=gnu++11 -pthread -O -fPIC -shared"
+#endif
+#ifndef IACA_SOURCE_DIR
+#define IACA_SOURCE_DIR "."
+#endif
+
+using namespace Iaca;
+
+std::mutex Module::_modmtx_;
+std::condition_variable Module::_modcond_;
+std::map<std::string,void*> Module::_modhandles_;
+std::string Module::_moddir_;
+std::string Module::_modcommand_;
+std::atomic<unsigned long> Module::_modnbcompiled_, Module::_modnbcached_;
+
+static std::string
+shell_quote(const std::string&s)
+{
+    std::string q = "'";
+    for (char c : s) {
+        if (c == '\'') q += "'\\''";
+        else q += c;
+    }
+    return q + "'";
+}
+
+std::string
+Module::cache_dir(void)
+{
+    std::lock_guard<std::mutex> gu(_modmtx_);
+    if (_moddir_.empty()) {
+        const char*envdir = getenv("IACA_MODULE_DIR");
+        const char*home = getenv("HOME");
+        if (envdir && envdir[0]) _moddir_ = envdir;
+        else _moddir_ = std::string(home?home:"/tmp") + "/.cache/iaca/modules";
+    }
+    return _moddir_;
+}
+
+void
+Module::set_cache_dir(const std::string&dir)
+{
+    std::lock_guard<std::mutex> gu(_modmtx_);
+    _moddir_ = dir;
+}
+
+std::string
+Module::compile_command(void)
+{
+    std::lock_guard<std::mutex> gu(_modmtx_);
+    if (_modcommand_.empty())
+        _modcommand_ = std::string(IACA_MODULE_CXX " " IACA_MODULE_FLAGS " -I")
+                       + shell_quote(IACA_SOURCE_DIR);
+    return _modcommand_;
+}
+
+void
+Module::set_compile_command(const std::string&cmd)
+{
+    std::lock_guard<std::mutex> gu(_modmtx_);
+    _modcommand_ = cmd;
+}
+
+// the header iaca was built from is part of the key, since a module
+// compiled against another layout of the values would crash
+std::string
+Module::key(const std::string&source)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    std::string cmd = compile_command();
+    hash.addData(cmd.data(), cmd.size()+1);
+    hash.addData(iaca_headerhash, strlen(iaca_headerhash)+1);
+    hash.addData(source.data(), source.size());
+    return hash.result().toHex().toStdString();
+}
+
+// the modules include the iaca.hh of the source directory, which must
+// be the one iaca was built from
+static void
+check_header(void)
+{
+    std::string path = IACA_SOURCE_DIR "/iaca.hh";
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot read module header " + path);
+    std::ostringstream out;
+    out << in.rdbuf();
+    std::string header = out.str();
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(header.data(), header.size());
+    if (hash.result().toHex().toStdString() != iaca_headerhash)
+        throw std::runtime_error("module header " + path
+                                 + " changed since iaca was built, rebuild iaca");
+}
+
+// the source and the shared object are written under temporary names
+// then renamed, so processes sharing the cache never see partial ones
+void*
+Module::compile_and_open(const std::string&key, const std::string&source)
+{
+    static std::atomic<unsigned> tmpcount;
+    std::string dir = cache_dir();
+    std::string sopath = dir + "/" + key + ".so";
+    if (!access(sopath.c_str(), R_OK)) {
+        IACA_TRACE_SCOPE("Module::open");
+        if (void*h = dlopen(sopath.c_str(), RTLD_NOW|RTLD_LOCAL)) {
+            _modnbcached_++;
+            return h;
+        }
+        // a stale or damaged shared object is compiled again
+    }
+    IACA_TRACE_SCOPE("Module::compile");
+    check_header();
+    if (!QDir().mkpath(QString::fromStdString(dir)))
+        throw std::runtime_error("cannot make module directory " + dir);
+    std::string srcpath = dir + "/" + key + ".cc";
+    std::string tmpsuffix = "." + std::to_string(getpid()) + "-" + std::to_string(tmpcount++);
+    std::string tmpsrcpath = dir + "/" + key + tmpsuffix + ".cc";
+    std::string tmppath = sopath + tmpsuffix;
+    {
+        std::ofstream out(tmpsrcpath);
+        out << source;
+        if (!out) {
+            unlink(tmpsrcpath.c_str());
+            throw std::runtime_error("cannot write module source " + tmpsrcpath);
+        }
+    }
+    std::string cmd = compile_command() + " -o " + shell_quote(tmppath)
+                      + " " + shell_quote(tmpsrcpath) + " 2>&1";
+    FILE*pipe = popen(cmd.c_str(), "r");
+    if (!pipe) {
+        unlink(tmpsrcpath.c_str());
+        throw std::runtime_error("cannot run module compiler");
+    }
+    std::string output;
+    char buf[1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), pipe)) > 0)
+        output.append(buf, n);
+    int status = pclose(pipe);
+    // the source is kept beside the shared object, for debugging
+    if (rename(tmpsrcpath.c_str(), srcpath.c_str())) unlink(tmpsrcpath.c_str());
+    if (status != 0) {
+        unlink(tmppath.c_str());
+        if (output.size() > 4096) output.resize(4096);
+        throw std::runtime_error("module " + srcpath + " failed to compile:\n" + output);
+    }
+    if (rename(tmppath.c_str(), sopath.c_str())) {
+        unlink(tmppath.c_str());
+        throw std::runtime_error("cannot rename module " + tmppath);
+    }
+    void*h = dlopen(sopath.c_str(), RTLD_NOW|RTLD_LOCAL);
+    if (!h) throw std::runtime_error(std::string("cannot load module: ") + dlerror());
+    _modnbcompiled_++;
+    return h;
+}
+
+// a module wanted by several threads at once is compiled by the first
+void*
+Module::load(const std::string&source)
+{
+    std::string k = key(source);
+    std::unique_lock<std::mutex> lk(_modmtx_);
+    for (;;) {
+        auto it = _modhandles_.find(k);
+        if (it == _modhandles_.end()) break;
+        if (it->second) return it->second;
+        _modcond_.wait(lk);
+    }
+    _modhandles_[k] = nullptr;
+    lk.unlock();
+    void*h = nullptr;
+    try {
+        h = compile_and_open(k, source);
+    }
+    catch (...) {
+        lk.lock();
+        _modhandles_.erase(k);
+        _modcond_.notify_all();
+        throw;
+    }
+    lk.lock();
+    _modhandles_[k] = h;
+    _modcond_.notify_all();
+    return h;
+}
+
+void*
+Module::symbol(void*handle, const char*name)
+{
+    void*ad = dlsym(handle, name);
+    if (!ad) throw std::runtime_error(std::string("module without symbol ") + name);
+    return ad;
+}
+
+std::function<bool(ItemVal*)>
+Module::compile_query(const std::string&expr)
+{
+    std::string source =
+        "// generated query module\n"
+        "#include \"iaca.hh\"\n"
+        "using namespace Iaca;\n"
+        "extern \"C\" bool iaca_module_query(ItemVal*itm)\n"
+        "{\n"
+        "    return (" + expr + ");\n"
+        "}\n";
+    auto fun = reinterpret_cast<bool(*)(ItemVal*)>(symbol(load(source), "iaca_module_query"));
+    return fun;
+}
+
+TaskletFun
+Module::compile_tasklet(const std::string&body)
+{
+    std::string source =
+        "// generated tasklet module\n"
+        "#include \"iaca.hh\"\n"
+        "using namespace Iaca;\n"
+        "extern \"C\" void iaca_module_tasklet(ItemPtr itp)\n"
+        "{\n"
+        "    (void) itp;\n" + body + "\n}\n";
+    auto fun = reinterpret_cast<void(*)(ItemPtr)>(symbol(load(source), "iaca_module_tasklet"));
+    return fun;
+}
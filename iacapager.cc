@@ -0,0 +1,331 @@
+// file iacapager.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacapager.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+
+using namespace Iaca;
+
+// Locking order: an item, then _pgmtx_. The evictor holds _pgmtx_ and
+// only try_lock-s items, so it never waits for them.
+
+std::atomic<bool> Pager::_pgopen_;
+std::mutex Pager::_pgmtx_;
+std::condition_variable Pager::_pgcond_;
+std::fstream Pager::_pgstore_;
+std::string Pager::_pgpath_;
+size_t Pager::_pgbudget_;
+size_t Pager::_pgresident_;
+std::vector<ItemVal*> Pager::_pgclock_;
+size_t Pager::_pghand_;
+std::thread Pager::_pgevictor_;
+bool Pager::_pgstop_;
+unsigned long Pager::_pgfaults_, Pager::_pgevictions_, Pager::_pgwrites_;
+unsigned long Pager::_pgwriteerrors_;
+std::string Pager::_pglasterror_;
+
+// a rough estimate: the map node and the sequence or string it owns
+size_t
+Pager::attr_bytes(const Value*v)
+{
+    if (!v) return 0;
+    switch (v->kind()) {
+    case ValKind::Str:
+        return 64 + static_cast<const StrVal*>(v)->bytes();
+    case ValKind::Tuple:
+    case ValKind::Set:
+        return 64 + static_cast<const SeqItemsVal*>(v)->bytes();
+    default:
+        return 64 + sizeof(IntVal);
+    }
+}
+
+size_t
+Pager::estimate_bytes(const ItemVal*itm)
+{
+    size_t bytes = 0;
+    for (auto&av : itm->_iattrmap)
+        bytes += attr_bytes(av.second.get());
+    return bytes;
+}
+
+void
+Pager::resized_slow(const ItemVal*itm, long delta)
+{
+    if (itm->_ipagestate.load() != PageState::PagedIn) return;
+    std::lock_guard<std::mutex> gu(_pgmtx_);
+    size_t old = itm->_ipagebytes;
+    size_t bytes = (delta < 0 && (size_t)-delta > old) ? 0 : old + delta;
+    _pgresident_ = _pgresident_ - std::min(_pgresident_, old) + bytes;
+    itm->_ipagebytes = bytes;
+    if (_pgresident_ > _pgbudget_) _pgcond_.notify_one();
+}
+
+void
+Pager::reestimate(const ItemVal*itm)
+{
+    if (!is_open() || itm->_ipagestate.load() != PageState::PagedIn) return;
+    resized_slow(itm, (long)estimate_bytes(itm) - (long)itm->_ipagebytes);
+}
+
+void
+Pager::touch_slow(const ItemVal*itm)
+{
+    if (itm->transient()) return;
+    itm->_ipageref.store(true,std::memory_order_relaxed);
+    PageState st = itm->_ipagestate.load();
+    if (st == PageState::PagedIn) return;
+    IACA_TRACE_SCOPE("Pager::touch");
+    std::string line;
+    if (st == PageState::PagedOut) {
+        std::lock_guard<std::mutex> gu(_pgmtx_);
+        _pgstore_.clear();
+        _pgstore_.seekg(itm->_ipageoff);
+        if (!std::getline(_pgstore_,line))
+            throw std::runtime_error("cannot read page store " + _pgpath_);
+        _pgfaults_++;
+    }
+    if (!line.empty()) {
+        Json::CharReaderBuilder rbuild;
+        std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+        Json::Value js;
+        std::string errs;
+        if (!reader->parse(line.data(),line.data()+line.size(),&js,&errs))
+            throw std::runtime_error("bad JSON in page store: " + errs);
+        itm->content_from_json_locked(js);
+        itm->_isavedversion = itm->_iversion.load();
+    }
+    else {
+        // a resident item adopted by the pager, not yet stored
+        itm->_ipageoff = (uint64_t)-1;
+        itm->_isavedversion = itm->_iversion.load() - 1;
+    }
+    size_t bytes = estimate_bytes(itm);
+    std::lock_guard<std::mutex> gu(_pgmtx_);
+    itm->_ipagebytes = bytes;
+    itm->_ipagestate.store(PageState::PagedIn);
+    _pgclock_.push_back(const_cast<ItemVal*>(itm));
+    _pgresident_ += bytes;
+    if (_pgresident_ > _pgbudget_) _pgcond_.notify_one();
+}
+
+// append the content at the end of the store, under _pgmtx_ and the item lock
+void
+Pager::write_back(ItemVal*itm)
+{
+    Json::StreamWriterBuilder wbuild;
+    wbuild["indentation"] = "";
+    std::string line = Json::writeString(wbuild,itm->content_json_locked());
+    _pgstore_.clear();
+    _pgstore_.seekp(0,std::ios::end);
+    uint64_t off = _pgstore_.tellp();
+    _pgstore_ << line << '\n';
+    _pgstore_.flush();
+    if (!_pgstore_) throw std::runtime_error("cannot write page store " + _pgpath_);
+    itm->_ipageoff = off;
+    itm->_isavedversion = itm->_iversion.load();
+    _pgwrites_++;
+}
+
+// one step of the CLOCK hand, under _pgmtx_; give true if some item was evicted
+bool
+Pager::evict_one(void)
+{
+    if (_pgclock_.empty()) return false;
+    if (_pghand_ >= _pgclock_.size()) _pghand_ = 0;
+    ItemVal*itm = _pgclock_[_pghand_];
+    std::unique_lock<std::mutex> lk(itm->_imtx, std::try_to_lock);
+    if (!lk.owns_lock() || itm->_ipageref.exchange(false)) {
+        _pghand_++;
+        return false;
+    }
+    if (itm->_iversion.load() != itm->_isavedversion)
+        write_back(itm);
+    std::map<ItemPtr,ValuePtr> oldattrs;
+    oldattrs.swap(itm->_iattrmap);
+    itm->_ipagestate.store(PageState::PagedOut);
+    _pgresident_ -= std::min(_pgresident_, itm->_ipagebytes);
+    itm->_ipagebytes = 0;
+    _pgclock_[_pghand_] = _pgclock_.back();
+    _pgclock_.pop_back();
+    _pgevictions_++;
+    return true;
+}
+
+void
+Pager::evict_loop(void)
+{
+    std::unique_lock<std::mutex> lk(_pgmtx_);
+    for (;;) {
+        _pgcond_.wait(lk, [] {
+            return _pgstop_ || _pgresident_ > _pgbudget_;
+        });
+        if (_pgstop_) return;
+        IACA_TRACE_SCOPE("Pager::evict");
+        // give up after two turns of the clock, every item being busy or hot
+        size_t nbsteps = 2*_pgclock_.size()+1;
+        bool failed = false;
+        while (_pgresident_ > _pgbudget_ && nbsteps-- > 0) {
+            // an item which cannot be written back stays resident and dirty,
+            // clean items may still be evicted
+            try {
+                evict_one();
+            }
+            catch (const std::exception&ex) {
+                _pgwriteerrors_++;
+                _pglasterror_ = ex.what();
+                _pghand_++;
+                failed = true;
+            }
+        }
+        if (_pgresident_ > _pgbudget_) {
+            lk.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(failed ? 100 : 1));
+            lk.lock();
+        }
+    }
+}
+
+// items already loaded, and items created later, are adopted as PagedIn
+// on their next access
+unsigned long
+Pager::open(const std::string&path, size_t budgetbytes)
+{
+    if (is_open()) throw std::runtime_error("pager already open");
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("cannot open page store " + path);
+    Json::CharReaderBuilder rbuild;
+    std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+    std::string line;
+    unsigned long nb = 0;
+    uint64_t off = 0;
+    while (std::getline(in,line)) {
+        uint64_t lineoff = off;
+        off += line.size()+1;
+        if (line.empty()) continue;
+        Json::Value js;
+        if (!reader->parse(line.data(),line.data()+line.size(),&js,nullptr))
+            throw std::runtime_error("bad JSON in page store " + path);
+        ItemPtr itp = ItemPtr::from_json(js);
+        if (!itp) throw std::runtime_error("bad item in page store " + path);
+        std::lock_guard<std::mutex> gu(itp->_imtx);
+        if (itp->_ipagestate.load() == PageState::PagedOut && itp->_ipageoff != lineoff)
+            nb--;		// a later line replaces an earlier one
+        itp->_iattrmap.clear();
+        itp->_ipageoff = lineoff;
+        itp->_ipagestate.store(PageState::PagedOut);
+        nb++;
+    }
+    _pgstore_.open(path, std::ios::in|std::ios::out|std::ios::binary);
+    if (!_pgstore_) throw std::runtime_error("cannot reopen page store " + path);
+    _pgpath_ = path;
+    _pgbudget_ = budgetbytes;
+    _pgresident_ = 0;
+    _pghand_ = 0;
+    _pgfaults_ = _pgevictions_ = _pgwrites_ = _pgwriteerrors_ = 0;
+    _pglasterror_.clear();
+    _pgstop_ = false;
+    _pgopen_.store(true);
+    _pgevictor_ = std::thread(evict_loop);
+    return nb;
+}
+
+void
+Pager::sync(void)
+{
+    if (!is_open()) return;
+    std::vector<ItemVal*> items;
+    {
+        std::lock_guard<std::mutex> gu(_pgmtx_);
+        items = _pgclock_;
+    }
+    for (ItemVal*itm : items) {
+        std::lock_guard<std::mutex> gui(itm->_imtx);
+        std::lock_guard<std::mutex> gup(_pgmtx_);
+        if (itm->_ipagestate.load() == PageState::PagedIn
+                && itm->_iversion.load() != itm->_isavedversion)
+            write_back(itm);
+    }
+}
+
+void
+Pager::close(void)
+{
+    if (!is_open()) return;
+    {
+        std::lock_guard<std::mutex> gu(_pgmtx_);
+        _pgstop_ = true;
+    }
+    _pgcond_.notify_all();
+    _pgevictor_.join();
+    ItemVal::scan_all_items([](ItemVal*itm) {
+        std::lock_guard<std::mutex> gu(itm->_imtx);
+        touch_slow(itm);
+        itm->_ipagestate.store(PageState::Resident);
+        return true;
+    });
+    std::lock_guard<std::mutex> gu(_pgmtx_);
+    _pgopen_.store(false);
+    _pgclock_.clear();
+    _pgresident_ = 0;
+    _pgstore_.close();
+}
+
+void
+Pager::stop(void)
+{
+    if (!is_open()) return;
+    // the evictor is joined even when the store cannot be written
+    std::exception_ptr err;
+    try {
+        sync();
+    }
+    catch (...) {
+        err = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> gu(_pgmtx_);
+        _pgstop_ = true;
+    }
+    _pgcond_.notify_all();
+    _pgevictor_.join();
+    {
+        std::lock_guard<std::mutex> gu(_pgmtx_);
+        _pgopen_.store(false);
+        _pgclock_.clear();
+        _pgresident_ = 0;
+        _pgstore_.close();
+    }
+    if (err) std::rethrow_exception(err);
+}
+
+Json::Value
+Pager::stats_json(void)
+{
+    std::lock_guard<std::mutex> gu(_pgmtx_);
+    Json::Value js {Json::objectValue};
+    js["open"] = is_open();
+    js["store"] = _pgpath_;
+    js["budget_bytes"] = (Json::UInt64)_pgbudget_;
+    js["resident_bytes"] = (Json::UInt64)_pgresident_;
+    js["paged_in_items"] = (Json::UInt64)_pgclock_.size();
+    js["faults"] = (Json::UInt64)_pgfaults_;
+    js["evictions"] = (Json::UInt64)_pgevictions_;
+    js["writes"] = (Json::UInt64)_pgwrites_;
+    js["write_errors"] = (Json::UInt64)_pgwriteerrors_;
+    if (!_pglasterror_.empty()) js["last_error"] = _pglasterror_;
+    return js;
+}
@@ -0,0 +1,757 @@
+// file iacashard.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacashard.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+using namespace Iaca;
+
+// The wire protocol. Every frame is a 32 bits length followed by that
+// many bytes: an opcode (or a status in replies) and its payload, in
+// native byte order since both ends run on the same host. The
+// coordinator pipelines its requests on one connection per shard, and
+// every request gets exactly one reply, in order.
+//
+// A value is a ValKind byte followed by: nothing for nil, 64 bits for
+// an integer or a double, a string as a 32 bits length and UTF-8 bytes,
+// an item as its radix string and 64 bits rank, a tuple or a set as a 32
+// bits count of items.
+
+int Shard::_shindex_ = -1;
+unsigned Shard::_shcount_;
+
+namespace {
+enum class Op :uint8_t {
+    Init,			// index, count
+    Make,			// radix -> item
+    Find,			// radix, rank -> item
+    Get,			// item, attr -> value
+    Put,			// item, attr, value (nil to remove)
+    Query,			// item -> count, (attr, value)*
+    Value,			// value -> value, normalized
+    Dump,			// path -> count
+    Close,
+};
+
+enum class Status :uint8_t {
+    Ok,
+    Error,			// message
+};
+
+class WireOut {
+    std::string&_wbuf;
+    size_t _wstart;
+public:
+    // start a frame at the end of the buffer
+    WireOut(std::string&buf) : _wbuf(buf), _wstart(buf.size()) {
+        put_u32(0);
+    };
+    // patch its length
+    ~WireOut() {
+        uint32_t len = _wbuf.size() - _wstart - sizeof(uint32_t);
+        memcpy(&_wbuf[_wstart], &len, sizeof(len));
+    };
+    void put_raw(const void*p, size_t n) {
+        _wbuf.append(static_cast<const char*>(p), n);
+    };
+    void put_u8(uint8_t b) {
+        _wbuf.push_back((char)b);
+    };
+    void put_u32(uint32_t u) {
+        put_raw(&u,sizeof(u));
+    };
+    void put_u64(uint64_t u) {
+        put_raw(&u,sizeof(u));
+    };
+    void put_str(const std::string&s) {
+        put_u32(s.size());
+        _wbuf.append(s);
+    };
+    void put_item(const ItemVal*itm) {
+        put_str(itm->radix()->val().toStdString());
+        put_u64(itm->rank());
+    };
+    void put_value(const Value*v);
+    void put_item_json(const Json::Value&js);
+    void put_value_json(const Json::Value&js);
+};
+
+class WireIn {
+    const char*_rcur;
+    const char*_rend;
+    void need(size_t n) {
+        if ((size_t)(_rend-_rcur) < n)
+            throw std::runtime_error("truncated shard frame");
+    };
+public:
+    WireIn(const char*start, size_t len) : _rcur(start), _rend(start+len) {};
+    void get_raw(void*p, size_t n) {
+        need(n);
+        memcpy(p, _rcur, n);
+        _rcur += n;
+    };
+    uint8_t get_u8(void) {
+        need(1);
+        return (uint8_t)*_rcur++;
+    };
+    uint32_t get_u32(void) {
+        uint32_t u;
+        get_raw(&u,sizeof(u));
+        return u;
+    };
+    uint64_t get_u64(void) {
+        uint64_t u;
+        get_raw(&u,sizeof(u));
+        return u;
+    };
+    std::string get_str(void) {
+        uint32_t len = get_u32();
+        need(len);
+        std::string s(_rcur,len);
+        _rcur += len;
+        return s;
+    };
+    ItemPtr get_item(void) {
+        std::string radix = get_str();
+        uint64_t rk = get_u64();
+        ItemPtr itp = ItemVal::find_or_make(QString::fromStdString(radix),rk);
+        if (!itp) throw std::runtime_error("bad item radix " + radix);
+        return itp;
+    };
+    ValuePtr get_value(void);
+    Json::Value get_item_json(void);
+    Json::Value get_value_json(void);
+};
+
+void
+WireOut::put_value(const Value*v)
+{
+    ValKind k = v ? v->kind() : ValKind::Nil;
+    put_u8((uint8_t)k);
+    switch (k) {
+    case ValKind::Nil:
+        break;
+    case ValKind::Int:
+        put_u64((int64_t)static_cast<const IntVal*>(v)->val());
+        break;
+    case ValKind::Dbl: {
+        double d = static_cast<const DblVal*>(v)->val();
+        put_raw(&d,sizeof(d));
+    }
+    break;
+    case ValKind::Str:
+        put_str(static_cast<const StrVal*>(v)->val().toStdString());
+        break;
+    case ValKind::Item:
+        put_item(static_cast<const ItemVal*>(v));
+        break;
+    case ValKind::Tuple:
+    case ValKind::Set: {
+        auto seq = static_cast<const SeqItemsVal*>(v);
+        put_u32(seq->size());
+        for (unsigned ix=0; ix<seq->size(); ix++)
+            put_item(seq->unsafe_at(ix));
+    }
+    break;
+    }
+}
+
+ValuePtr
+WireIn::get_value(void)
+{
+    ValKind k = (ValKind)get_u8();
+    switch (k) {
+    case ValKind::Nil:
+        return nullptr;
+    case ValKind::Int:
+        return ValuePtr(new IntVal((int64_t)get_u64()));
+    case ValKind::Dbl: {
+        double d;
+        get_raw(&d,sizeof(d));
+        return ValuePtr(new DblVal(d));
+    }
+    case ValKind::Str:
+        return ValuePtr(StrVal::make(get_str()));
+    case ValKind::Item:
+        return get_item();
+    case ValKind::Tuple:
+    case ValKind::Set: {
+        std::vector<ItemPtr> vec(get_u32());
+        for (ItemPtr&itp : vec) itp = get_item();
+        if (k == ValKind::Tuple)
+            return ValuePtr(const_cast<TupleVal*>(TupleVal::make(vec)));
+        else
+            return ValuePtr(const_cast<SetVal*>(SetVal::make(vec)));
+    }
+    }
+    throw std::runtime_error("bad value kind in shard frame");
+}
+
+// the coordinator translates between JSON and the wire, without making
+// any item; the JSON is the one of ValuePtr::from_json and to_json
+
+void
+WireOut::put_item_json(const Json::Value&js)
+{
+    if (!js.isObject() || !js["item"].isString())
+        throw std::runtime_error("bad item in JSON");
+    put_str(js["item"].asString());
+    put_u64(js.isMember("irank") ? js["irank"].asUInt64() : 0);
+}
+
+void
+WireOut::put_value_json(const Json::Value&js)
+{
+    switch (js.type()) {
+    case Json::nullValue:
+        put_u8((uint8_t)ValKind::Nil);
+        return;
+    case Json::intValue:
+    case Json::uintValue:
+        put_u8((uint8_t)ValKind::Int);
+        put_u64(js.asInt64());
+        return;
+    case Json::realValue: {
+        double d = js.asDouble();
+        put_u8((uint8_t)ValKind::Dbl);
+        put_raw(&d,sizeof(d));
+    }
+    return;
+    case Json::stringValue:
+        put_u8((uint8_t)ValKind::Str);
+        put_str(js.asString());
+        return;
+    case Json::objectValue:
+        if (js.isMember("item")) {
+            put_u8((uint8_t)ValKind::Item);
+            put_item_json(js);
+            return;
+        }
+        else if (js["kind"].asString() == "tuple" || js["kind"].asString() == "set") {
+            bool istuple = js["kind"].asString() == "tuple";
+            const Json::Value&jcomp = js[istuple?"comp":"elem"];
+            put_u8((uint8_t)(istuple?ValKind::Tuple:ValKind::Set));
+            put_u32(jcomp.size());
+            for (const Json::Value&jc : jcomp)
+                put_item_json(jc);
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+    throw std::runtime_error("unexpected JSON for value");
+}
+
+Json::Value
+WireIn::get_item_json(void)
+{
+    Json::Value js {Json::objectValue};
+    js["item"] = get_str();
+    uint64_t rk = get_u64();
+    if (rk>0) js["irank"] = (Json::Int64)rk;
+    return js;
+}
+
+Json::Value
+WireIn::get_value_json(void)
+{
+    ValKind k = (ValKind)get_u8();
+    switch (k) {
+    case ValKind::Nil:
+        return Json::Value();
+    case ValKind::Int:
+        return (Json::Int64)get_u64();
+    case ValKind::Dbl: {
+        double d;
+        get_raw(&d,sizeof(d));
+        return d;
+    }
+    case ValKind::Str:
+        return get_str();
+    case ValKind::Item:
+        return get_item_json();
+    case ValKind::Tuple:
+    case ValKind::Set: {
+        bool istuple = k == ValKind::Tuple;
+        Json::Value j {Json::objectValue};
+        Json::Value t {Json::arrayValue};
+        for (uint32_t nb = get_u32(); nb>0; nb--)
+            t.append(get_item_json());
+        j["kind"] = istuple ? "tuple" : "set";
+        j[istuple?"comp":"elem"] = t;
+        return j;
+    }
+    }
+    throw std::runtime_error("bad value kind in shard frame");
+}
+
+// a non-blocking socket with its buffered input and output
+struct Conn {
+    int _cfd = -1;
+    std::string _cin;
+    size_t _cinpos = 0;
+    std::string _cout;
+    size_t _coutpos = 0;
+    void set_nonblocking(void) {
+        int fl = fcntl(_cfd, F_GETFL);
+        if (fl < 0 || fcntl(_cfd, F_SETFL, fl|O_NONBLOCK) < 0)
+            throw std::runtime_error(std::string("cannot make shard socket non-blocking: ") + strerror(errno));
+    };
+    // block till the socket is ready for some of the events
+    void wait(short events) {
+        pollfd pfd {_cfd, events, 0};
+        while (poll(&pfd, 1, -1) < 0)
+            if (errno != EINTR)
+                throw std::runtime_error(std::string("shard poll failed: ") + strerror(errno));
+    };
+    // read what is available without blocking, give false at end of file
+    bool fill(void) {
+        if (_cinpos > 0) {
+            _cin.erase(0,_cinpos);
+            _cinpos = 0;
+        }
+        char buf[65536];
+        for (;;) {
+            ssize_t n = read(_cfd, buf, sizeof(buf));
+            if (n > 0) {
+                _cin.append(buf,n);
+                return true;
+            }
+            if (n == 0) return false;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno != EINTR)
+                throw std::runtime_error(std::string("shard socket read failed: ") + strerror(errno));
+        }
+    };
+    // give the next complete frame if any
+    bool next_frame(WireIn*&frame, std::unique_ptr<WireIn>&holder) {
+        uint32_t len;
+        if (_cin.size() - _cinpos < sizeof(len)) return false;
+        memcpy(&len, _cin.data()+_cinpos, sizeof(len));
+        if (_cin.size() - _cinpos - sizeof(len) < len) return false;
+        holder.reset(new WireIn(_cin.data()+_cinpos+sizeof(len), len));
+        frame = holder.get();
+        _cinpos += sizeof(len)+len;
+        return true;
+    };
+    // write what the socket takes without blocking
+    void drain_some(void) {
+        ssize_t n = send(_cfd, _cout.data()+_coutpos, _cout.size()-_coutpos, MSG_NOSIGNAL);
+        if (n<0 && errno!=EINTR && errno!=EAGAIN && errno!=EWOULDBLOCK)
+            throw std::runtime_error(std::string("shard socket write failed: ") + strerror(errno));
+        if (n>0) _coutpos += n;
+        if (_coutpos == _cout.size()) {
+            _cout.clear();
+            _coutpos = 0;
+        }
+    };
+};
+
+sockaddr_un
+socket_address(const std::string&path)
+{
+    sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("shard socket path too long " + path);
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+// handle one request in the shard, give false on Close
+bool
+serve_request(WireIn&req, std::string&outbuf)
+{
+    WireOut rep(outbuf);
+    Op op = (Op)req.get_u8();
+    size_t start = outbuf.size();
+    try {
+        rep.put_u8((uint8_t)Status::Ok);
+        switch (op) {
+        case Op::Init: {
+            unsigned index = req.get_u32();
+            Shard::set_shard(index, req.get_u32());
+        }
+        break;
+        case Op::Make: {
+            ItemPtr itp = ItemVal::make(QString::fromStdString(req.get_str()));
+            if (!itp) throw std::runtime_error("invalid radix");
+            rep.put_value(itp.get());
+        }
+        break;
+        case Op::Find:
+            rep.put_value(req.get_item().get());
+            break;
+        case Op::Get: {
+            ItemPtr itp = req.get_item();
+            ItemPtr attr = req.get_item();
+            rep.put_value(itp->get_attr(attr).get());
+        }
+        break;
+        case Op::Put: {
+            ItemPtr itp = req.get_item();
+            ItemPtr attr = req.get_item();
+            ValuePtr val = req.get_value();
+            if (val) itp->put_attr(attr,val);
+            else itp->remove_attr(attr);
+        }
+        break;
+        case Op::Query: {
+            ItemPtr itp = req.get_item();
+            std::vector<std::pair<ItemPtr,ValuePtr>> attrs;
+            itp->scan_attrs([&](ItemPtr at, ValuePtr va) {
+                attrs.emplace_back(at,va);
+                return true;
+            });
+            rep.put_item(itp.get());
+            rep.put_u32(attrs.size());
+            for (auto&av : attrs) {
+                rep.put_item(av.first.get());
+                rep.put_value(av.second.get());
+            }
+        }
+        break;
+        case Op::Value:
+            rep.put_value(req.get_value().get());
+            break;
+        case Op::Dump:
+            rep.put_u64(Dumper::dump_file(req.get_str()));
+            break;
+        case Op::Close:
+            return false;
+        default:
+            throw std::runtime_error("unknown shard request");
+        }
+    }
+    catch (const std::exception&ex) {
+        outbuf.resize(start);
+        rep.put_u8((uint8_t)Status::Error);
+        rep.put_str(ex.what());
+    }
+    return true;
+}
+
+// what the coordinator does with a reply, in command order
+enum class Expect :uint8_t {
+    Print,
+    Ack,
+    Query,
+};
+
+struct Pending {
+    unsigned _pshard;
+    Expect _pexpect;
+    unsigned long _plineno;
+};
+
+class Coordinator {
+    std::vector<Conn> _conns;
+    std::vector<pid_t> _pids;
+    std::string _dir;
+    std::deque<Pending> _pending;
+    std::ostream&_out;
+    Json::StreamWriterBuilder _wbuild;
+    bool _closed;		// the shards were closed and will exit
+    // write every output while reading the replies, so that neither side
+    // blocks on a full socket
+    void pump(void) {
+        IACA_TRACE_SCOPE("Shard::pump");
+        for (;;) {
+            std::vector<pollfd> pfds;
+            bool writing = false;
+            for (Conn&c : _conns) {
+                pfds.push_back({c._cfd, (short)(POLLIN | (c._cout.empty()?0:POLLOUT)), 0});
+                writing = writing || !c._cout.empty();
+            }
+            if (!writing) return;
+            if (poll(pfds.data(), pfds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("shard poll failed: ") + strerror(errno));
+            }
+            for (unsigned ix=0; ix<pfds.size(); ix++) {
+                if (pfds[ix].revents & (POLLIN|POLLHUP|POLLERR))
+                    if (!_conns[ix].fill() && !_conns[ix]._cout.empty())
+                        throw std::runtime_error("shard " + std::to_string(ix) + " died");
+                if (pfds[ix].revents & POLLOUT)
+                    _conns[ix].drain_some();
+            }
+        }
+    };
+    void handle_reply(const Pending&pd, WireIn&rep) {
+        Status st = (Status)rep.get_u8();
+        if (st != Status::Ok)
+            throw std::runtime_error(rep.get_str());
+        switch (pd._pexpect) {
+        case Expect::Ack:
+            break;
+        case Expect::Print:
+            _out << Json::writeString(_wbuild,rep.get_value_json()) << '\n';
+            break;
+        case Expect::Query: {
+            Json::Value js = rep.get_item_json();
+            Json::Value jattrs {Json::arrayValue};
+            for (uint32_t nb = rep.get_u32(); nb>0; nb--) {
+                Json::Value jav {Json::objectValue};
+                jav["at"] = rep.get_item_json();
+                jav["va"] = rep.get_value_json();
+                jattrs.append(jav);
+            }
+            js["attrs"] = jattrs;
+            _out << Json::writeString(_wbuild,js) << '\n';
+        }
+        break;
+        }
+    };
+public:
+    Coordinator(std::ostream&out)
+        : _conns(), _pids(), _dir(), _pending(), _out(out), _wbuild(), _closed(false) {
+        _wbuild["indentation"] = "";
+    };
+    ~Coordinator() {
+        for (Conn&c : _conns)
+            if (c._cfd >= 0) close(c._cfd);
+        // on failure, some shards may still wait in accept
+        if (!_closed)
+            for (pid_t pid : _pids) kill(pid, SIGTERM);
+        for (pid_t pid : _pids) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+        }
+        for (unsigned ix=0; ix<_pids.size(); ix++)
+            unlink((_dir + "/shard" + std::to_string(ix)).c_str());
+        if (!_dir.empty()) rmdir(_dir.c_str());
+    };
+    unsigned nb_shards(void) const {
+        return _conns.size();
+    };
+    void spawn(unsigned nbshards, const std::string&program) {
+        const char*tmpdir = getenv("TMPDIR");
+        std::string templ = std::string(tmpdir?tmpdir:"/tmp") + "/iaca-shards-XXXXXX";
+        if (!mkdtemp(&templ[0]))
+            throw std::runtime_error("cannot make shard directory " + templ);
+        _dir = templ;
+        for (unsigned ix=0; ix<nbshards; ix++) {
+            std::string path = _dir + "/shard" + std::to_string(ix);
+            pid_t pid = fork();
+            if (pid < 0) throw std::runtime_error("cannot fork shard");
+            if (pid == 0) {
+                execl(program.c_str(), program.c_str(), "--batch", "--shard-serve", path.c_str(), (char*)nullptr);
+                perror(program.c_str());
+                _exit(127);
+            }
+            _pids.push_back(pid);
+        }
+        for (unsigned ix=0; ix<nbshards; ix++) {
+            sockaddr_un addr = socket_address(_dir + "/shard" + std::to_string(ix));
+            _conns.emplace_back();
+            _conns.back()._cfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+            // the shard binds its socket once started
+            for (unsigned tries=0;; tries++) {
+                if (!connect(_conns.back()._cfd, (const sockaddr*)&addr, sizeof(addr))) break;
+                int status = 0;
+                if (tries >= 1000 || waitpid(_pids[ix], &status, WNOHANG) == _pids[ix])
+                    throw std::runtime_error("cannot connect to shard " + std::to_string(ix));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            _conns.back().set_nonblocking();
+            request(ix, Op::Init, Expect::Ack, 0, [=](WireOut&req) {
+                req.put_u32(ix);
+                req.put_u32(nbshards);
+            });
+        }
+    };
+    // queue a request to a shard, its reply is expected in order; the
+    // payload is encoded first, so a bad one throws before anything is queued
+    void request(unsigned shix, Op op, Expect ex, unsigned long lineno,
+                 std::function<void(WireOut&)> payload = nullptr) {
+        std::string frame;
+        {
+            WireOut req(frame);
+            req.put_u8((uint8_t)op);
+            if (payload) payload(req);
+        }
+        _conns[shix]._cout.append(frame);
+        _pending.push_back({shix, ex, lineno});
+    };
+    // send everything and handle all the replies
+    void sync(void) {
+        IACA_TRACE_SCOPE("Shard::sync");
+        pump();
+        while (!_pending.empty()) {
+            Pending pd = _pending.front();
+            _pending.pop_front();
+            Conn&c = _conns[pd._pshard];
+            WireIn*rep = nullptr;
+            std::unique_ptr<WireIn> holder;
+            while (!c.next_frame(rep,holder)) {
+                c.wait(POLLIN);
+                if (!c.fill())
+                    throw std::runtime_error("shard " + std::to_string(pd._pshard) + " died");
+            }
+            try {
+                handle_reply(pd,*rep);
+            }
+            catch (const std::exception&ex) {
+                std::cerr << "iaca: command at line " << pd._plineno
+                          << " failed: " << ex.what() << std::endl;
+            }
+        }
+        _out.flush();
+    };
+    size_t nb_pending(void) const {
+        return _pending.size();
+    };
+    void close_shards(void) {
+        for (unsigned ix=0; ix<_conns.size(); ix++)
+            request(ix, Op::Close, Expect::Ack, 0);
+        sync();
+        _closed = true;
+    };
+};
+};
+
+unsigned long
+Shard::serve(const std::string&sockpath)
+{
+    sockaddr_un addr = socket_address(sockpath);
+    int lfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    unlink(sockpath.c_str());
+    if (lfd < 0 || bind(lfd, (const sockaddr*)&addr, sizeof(addr)) || listen(lfd, 1))
+        throw std::runtime_error("cannot listen on shard socket " + sockpath);
+    Conn c;
+    c._cfd = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+    close(lfd);
+    unlink(sockpath.c_str());
+    if (c._cfd < 0) throw std::runtime_error("cannot accept on shard socket " + sockpath);
+    c.set_nonblocking();
+    unsigned long nb = 0;
+    bool open = true;
+    // keep reading while the replies are written, as the coordinator
+    // does; the replies to every request read at once go in one write
+    while (open || !c._cout.empty()) {
+        IACA_TRACE_SCOPE("Shard::serve");
+        c.wait((open ? POLLIN : 0) | (c._cout.empty() ? 0 : POLLOUT));
+        if (!c._cout.empty()) c.drain_some();
+        if (!open) continue;
+        if (!c.fill()) break;
+        WireIn*req = nullptr;
+        std::unique_ptr<WireIn> holder;
+        while (open && c.next_frame(req,holder)) {
+            open = serve_request(*req,c._cout);
+            nb++;
+        }
+        if (!c._cout.empty()) c.drain_some();
+    }
+    close(c._cfd);
+    return nb;
+}
+
+unsigned long
+Shard::coordinate(std::istream&in, std::ostream&out, unsigned nbshards, const std::string&program)
+{
+    if (nbshards == 0) throw std::runtime_error("no shards");
+    Coordinator coord(out);
+    coord.spawn(nbshards, program);
+    Json::CharReaderBuilder rbuild;
+    std::unique_ptr<Json::CharReader> reader(rbuild.newCharReader());
+    std::string line;
+    unsigned long lineno = 0, nb = 0;
+    auto shard_of_item = [&](const Json::Value&jitem) {
+        if (!jitem.isObject() || !jitem["item"].isString())
+            throw std::runtime_error("bad item");
+        return shard_of(QString::fromStdString(jitem["item"].asString()), nbshards);
+    };
+    while (std::getline(in,line)) {
+        lineno++;
+        if (line.empty() || line[0] == '#') continue;
+        Json::Value js;
+        std::string errs;
+        try {
+            if (!reader->parse(line.data(),line.data()+line.size(),&js,&errs))
+                throw std::runtime_error("bad JSON: " + errs);
+            std::string cmd = js["cmd"].asString();
+            if (cmd == "item") {
+                std::string radix = js["radix"].asString();
+                unsigned shix = shard_of(QString::fromStdString(radix), nbshards);
+                if (js.isMember("irank"))
+                    coord.request(shix, Op::Find, Expect::Print, lineno, [&](WireOut&req) {
+                    req.put_str(radix);
+                    req.put_u64(js["irank"].asUInt64());
+                });
+                else
+                    coord.request(shix, Op::Make, Expect::Print, lineno, [&](WireOut&req) {
+                    req.put_str(radix);
+                });
+            }
+            else if (cmd == "put" || cmd == "get") {
+                bool isput = cmd == "put";
+                coord.request(shard_of_item(js["item"]), isput?Op::Put:Op::Get,
+                isput?Expect::Ack:Expect::Print, lineno, [&](WireOut&req) {
+                    req.put_item_json(js["item"]);
+                    req.put_item_json(js["attr"]);
+                    if (isput) req.put_value_json(js["val"]);
+                });
+            }
+            else if (cmd == "query")
+                coord.request(shard_of_item(js["item"]), Op::Query, Expect::Query, lineno,
+                [&](WireOut&req) {
+                req.put_item_json(js["item"]);
+            });
+            else if (cmd == "tuple" || cmd == "set") {
+                Json::Value jv {js};
+                jv["kind"] = cmd;
+                // the set is normalized by a shard
+                coord.request(0, Op::Value, Expect::Print, lineno, [&](WireOut&req) {
+                    req.put_value_json(jv);
+                });
+            }
+            else if (cmd == "dump") {
+                std::string prefix = js["file"].asString();
+                if (prefix.empty()) throw std::runtime_error("no dump file");
+                for (unsigned shix=0; shix<nbshards; shix++) {
+                    char suffix[32];
+                    snprintf(suffix, sizeof(suffix), "-%05u.jsonl", shix);
+                    coord.request(shix, Op::Dump, Expect::Ack, lineno, [&](WireOut&req) {
+                        req.put_str(prefix + suffix);
+                    });
+                }
+            }
+            else
+                throw std::runtime_error("unknown command " + cmd);
+            nb++;
+        }
+        catch (const std::exception&ex) {
+            std::cerr << "iaca: command at line " << lineno
+                      << " failed: " << ex.what() << std::endl;
+        }
+        if (coord.nb_pending() >= BatchPipeline::batch_size)
+            coord.sync();
+    }
+    coord.close_shards();
+    return nb;
+}
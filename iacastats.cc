@@ -0,0 +1,228 @@
+// file iacastats.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacastats.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <iostream>
+#include <unordered_set>
+
+using namespace Iaca;
+
+thread_local Stats::Counters* Stats::_curcounters_;
+std::vector<Stats::Counters*> Stats::_allcounters_;
+std::mutex Stats::_statmtx_;
+std::condition_variable Stats::_statcond_;
+std::thread Stats::_periodic_thread_;
+bool Stats::_periodic_stop_;
+
+Stats::Counters*
+Stats::register_counters(void)
+{
+    Counters*c = new Counters;
+    for (unsigned k=0; k<nb_val_kinds; k++) {
+        c->_nbmade[k].store(0);
+        c->_nbfreed[k].store(0);
+        c->_bytesmade[k].store(0);
+        c->_bytesfreed[k].store(0);
+    }
+    std::lock_guard<std::mutex> gu(_statmtx_);
+    _allcounters_.push_back(c);
+    return c;
+}
+
+const char*
+Stats::kind_name(ValKind k)
+{
+    switch (k) {
+    case ValKind::Nil:
+        return "nil";
+    case ValKind::Int:
+        return "int";
+    case ValKind::Dbl:
+        return "dbl";
+    case ValKind::Str:
+        return "str";
+    case ValKind::Item:
+        return "item";
+    case ValKind::Tuple:
+        return "tuple";
+    case ValKind::Set:
+        return "set";
+    }
+    return "?";
+}
+
+Json::Value
+Stats::counters_json(void)
+{
+    long nbmade[nb_val_kinds] = {0}, nbfreed[nb_val_kinds] = {0};
+    long bytesmade[nb_val_kinds] = {0}, bytesfreed[nb_val_kinds] = {0};
+    {
+        std::lock_guard<std::mutex> gu(_statmtx_);
+        for (Counters*c : _allcounters_)
+            for (unsigned k=0; k<nb_val_kinds; k++) {
+                nbmade[k] += c->_nbmade[k].load(std::memory_order_relaxed);
+                nbfreed[k] += c->_nbfreed[k].load(std::memory_order_relaxed);
+                bytesmade[k] += c->_bytesmade[k].load(std::memory_order_relaxed);
+                bytesfreed[k] += c->_bytesfreed[k].load(std::memory_order_relaxed);
+            }
+    }
+    Json::Value js {Json::objectValue};
+    for (unsigned k=1; k<nb_val_kinds; k++) {
+        Json::Value jk {Json::objectValue};
+        jk["made"] = (Json::Int64)nbmade[k];
+        jk["freed"] = (Json::Int64)nbfreed[k];
+        jk["live"] = (Json::Int64)(nbmade[k]-nbfreed[k]);
+        jk["live_bytes"] = (Json::Int64)(bytesmade[k]-bytesfreed[k]);
+        js[kind_name((ValKind)k)] = jk;
+    }
+    return js;
+}
+
+// power of two buckets: 0, 1, 2-3, 4-7, ...
+namespace {
+class Histogram {
+    std::vector<unsigned long> _hcount;
+public:
+    void add(unsigned long n) {
+        unsigned b = 0;
+        while (n >> b) b++;
+        if (_hcount.size() <= b) _hcount.resize(b+1);
+        _hcount[b]++;
+    };
+    Json::Value to_json(void) const {
+        Json::Value js {Json::objectValue};
+        for (unsigned b=0; b<_hcount.size(); b++) {
+            if (!_hcount[b]) continue;
+            std::string label;
+            if (b<=1) label = std::to_string(b);
+            else label = std::to_string(1UL<<(b-1)) + "-" + std::to_string((1UL<<b)-1);
+            js[label] = (Json::UInt64)_hcount[b];
+        }
+        return js;
+    };
+};
+};
+
+Json::Value
+Stats::census_json(void)
+{
+    unsigned long nbitems = 0, nbattrs = 0, nbpayloads = 0;
+    unsigned long nbvals[nb_val_kinds] = {0}, bytesvals[nb_val_kinds] = {0};
+    Histogram fanout, tuplesizes, setsizes, radixsizes;
+    std::unordered_set<const Value*> seen;
+    const StrVal*currad = nullptr;
+    unsigned long nbinradix = 0;
+    ItemVal::scan_all_items([&](ItemVal*itm) {
+        nbitems++;
+        if (itm->payload()) nbpayloads++;
+        // items are scanned radix by radix
+        if (itm->radix() != currad) {
+            if (currad) radixsizes.add(nbinradix);
+            currad = itm->radix();
+            nbinradix = 0;
+        }
+        nbinradix++;
+        unsigned nbat = 0;
+        itm->scan_attrs([&](ItemPtr, ValuePtr val) {
+            nbat++;
+            const Value*v = val.get();
+            if (!v || v->kind()==ValKind::Item || !seen.insert(v).second)
+                return true;
+            unsigned k = (unsigned)v->kind();
+            nbvals[k]++;
+            switch (v->kind()) {
+            case ValKind::Int:
+                bytesvals[k] += sizeof(IntVal);
+                break;
+            case ValKind::Dbl:
+                bytesvals[k] += sizeof(DblVal);
+                break;
+            case ValKind::Str:
+                bytesvals[k] += static_cast<const StrVal*>(v)->bytes();
+                break;
+            case ValKind::Tuple:
+                bytesvals[k] += static_cast<const TupleVal*>(v)->bytes();
+                tuplesizes.add(static_cast<const TupleVal*>(v)->size());
+                break;
+            case ValKind::Set:
+                bytesvals[k] += static_cast<const SetVal*>(v)->bytes();
+                setsizes.add(static_cast<const SetVal*>(v)->size());
+                break;
+            default:
+                break;
+            }
+            return true;
+        });
+        nbattrs += nbat;
+        fanout.add(nbat);
+        return true;
+    });
+    if (currad) radixsizes.add(nbinradix);
+    nbvals[(unsigned)ValKind::Item] = nbitems;
+    bytesvals[(unsigned)ValKind::Item] = nbitems*sizeof(ItemVal);
+    Json::Value js {Json::objectValue};
+    js["items"] = (Json::UInt64)nbitems;
+    js["attributes"] = (Json::UInt64)nbattrs;
+    js["payloads"] = (Json::UInt64)nbpayloads;
+    js["radixes"] = ItemVal::nb_radixes();
+    Json::Value jkinds {Json::objectValue};
+    for (unsigned k=1; k<nb_val_kinds; k++) {
+        Json::Value jk {Json::objectValue};
+        jk["count"] = (Json::UInt64)nbvals[k];
+        jk["bytes"] = (Json::UInt64)bytesvals[k];
+        jkinds[kind_name((ValKind)k)] = jk;
+    }
+    js["kinds"] = jkinds;
+    js["fanout_histogram"] = fanout.to_json();
+    js["tuple_size_histogram"] = tuplesizes.to_json();
+    js["set_size_histogram"] = setsizes.to_json();
+    js["items_per_radix_histogram"] = radixsizes.to_json();
+    return js;
+}
+
+void
+Stats::start_periodic(unsigned secs)
+{
+    if (secs==0 || _periodic_thread_.joinable()) return;
+    _periodic_stop_ = false;
+    _periodic_thread_ = std::thread([=](void) {
+        Json::StreamWriterBuilder wbuild;
+        wbuild["indentation"] = "";
+        std::unique_lock<std::mutex> lk(_statmtx_);
+        while (!_statcond_.wait_for(lk, std::chrono::seconds(secs),
+        [] { return _periodic_stop_; })) {
+            lk.unlock();
+            Json::Value js {Json::objectValue};
+            js["time"] = (Json::Int64)time(nullptr);
+            js["counters"] = counters_json();
+            std::cerr << Json::writeString(wbuild,js) << std::endl;
+            lk.lock();
+        }
+    });
+}
+
+void
+Stats::stop_periodic(void)
+{
+    if (!_periodic_thread_.joinable()) return;
+    {
+        std::lock_guard<std::mutex> gu(_statmtx_);
+        _periodic_stop_ = true;
+    }
+    _statcond_.notify_all();
+    _periodic_thread_.join();
+}
@@ -0,0 +1,134 @@
+// file iacatrace.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacatrace.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+#include <unistd.h>
+
+using namespace Iaca;
+
+thread_local Trace::Ring* Trace::_curring_;
+std::vector<Trace::Ring*> Trace::_allrings_;
+std::mutex Trace::_trmtx_;
+std::atomic<bool> Trace::_enabled_;
+
+Trace::Ring*
+Trace::register_ring(void)
+{
+    Ring*r = new Ring;
+    r->_rhead.store(0);
+    std::lock_guard<std::mutex> gu(_trmtx_);
+    r->_rtid = _allrings_.size()+1;
+    _allrings_.push_back(r);
+    return r;
+}
+
+// events overwritten by their thread while we copy them are dropped
+std::vector<std::pair<unsigned,Trace::Event>>
+Trace::snapshot(void)
+{
+    std::vector<std::pair<unsigned,Event>> vev;
+    std::lock_guard<std::mutex> gu(_trmtx_);
+    for (Ring*r : _allrings_) {
+        uint64_t h = r->_rhead.load(std::memory_order_acquire);
+        uint64_t lo = h>ring_size ? h-ring_size : 0;
+        std::vector<Event> copy;
+        copy.reserve(h-lo);
+        for (uint64_t ix=lo; ix<h; ix++)
+            copy.push_back(r->_revents[ix % ring_size]);
+        // the copy must not move past the second load of the head
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t h2 = r->_rhead.load(std::memory_order_relaxed);
+        // the slot of event h2 may be under writing, as is the event
+        // h2-ring_size which shares it
+        uint64_t valid = h2+1>ring_size ? h2+1-ring_size : 0;
+        for (uint64_t ix=std::max(lo,valid); ix<h; ix++)
+            vev.push_back({r->_rtid, copy[ix-lo]});
+    }
+    std::sort(vev.begin(),vev.end(),
+              [](const std::pair<unsigned,Event>&p1, const std::pair<unsigned,Event>&p2) {
+        if (p1.first != p2.first) return p1.first < p2.first;
+        if (p1.second._estart != p2.second._estart)
+            return p1.second._estart < p2.second._estart;
+        // the enclosing scope first
+        return p1.second._edur > p2.second._edur;
+    });
+    return vev;
+}
+
+void
+Trace::write_chrome_trace(std::ostream&out)
+{
+    auto vev = snapshot();
+    int pid = getpid();
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char buf[64];
+    for (auto&tev : vev) {
+        out << (first?"\n":",\n") << "{\"name\":"
+            << Json::valueToQuotedString(tev.second._ename)
+            << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tev.first;
+        // Chrome wants microseconds
+        snprintf(buf, sizeof(buf), ",\"ts\":%.3f,\"dur\":%.3f}",
+                 tev.second._estart/1000.0, tev.second._edur/1000.0);
+        out << buf;
+        first = false;
+    }
+    out << "\n]}" << std::endl;
+}
+
+// rebuild the stacks of each thread by nesting of the intervals, and
+// give the self time in nanoseconds of every distinct stack
+void
+Trace::write_folded_stacks(std::ostream&out)
+{
+    auto vev = snapshot();
+    std::map<std::string,uint64_t> folded;
+    struct Frame {
+        std::string _fpath;
+        uint64_t _fend;
+        uint64_t _fself;
+    };
+    std::vector<Frame> stack;
+    unsigned curtid = 0;
+    auto pop_frame = [&](void) {
+        folded[stack.back()._fpath] += stack.back()._fself;
+        stack.pop_back();
+    };
+    for (auto&tev : vev) {
+        const Event&ev = tev.second;
+        if (tev.first != curtid) {
+            while (!stack.empty()) pop_frame();
+            curtid = tev.first;
+        }
+        while (!stack.empty() && stack.back()._fend <= ev._estart)
+            pop_frame();
+        std::string path = stack.empty()
+                           ? std::string("thread") + std::to_string(curtid)
+                           : stack.back()._fpath;
+        path += ';';
+        path += ev._ename;
+        if (!stack.empty()) {
+            Frame&parent = stack.back();
+            parent._fself -= std::min(parent._fself, ev._edur);
+        }
+        stack.push_back({path, ev._estart+ev._edur, ev._edur});
+    }
+    while (!stack.empty()) pop_frame();
+    for (auto&f : folded)
+        out << f.first << ' ' << f.second << '\n';
+    out.flush();
+}
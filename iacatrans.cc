@@ -0,0 +1,97 @@
+// file iacatrans.cc
+
+// © 2016 Basile Starynkevitch
+//   this file iacatrans.cc is part of IaCa
+//   IaCa is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   IaCa is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with IaCa.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "iaca.hh"
+
+using namespace Iaca;
+
+ValuePtr
+Transaction::get_attr(ItemPtr itp, ItemPtr attr)
+{
+    ItemVal*itm = itp.get();
+    if (!itm || !attr) return nullptr;
+    auto wit = _trwriteset.find(itm);
+    if (wit != _trwriteset.end()) {
+        auto ait = wit->second.find(attr);
+        if (ait != wit->second.end())
+            return ait->second;
+    }
+    std::lock_guard<std::mutex> gu(itm->_imtx);
+    Pager::touch(itm);
+    uint64_t ver = itm->_iversion.load();
+    auto rit = _trreadset.find(itm);
+    if (rit == _trreadset.end()) {
+        _trreadset[itm] = ver;
+        _trkeep.push_back(itp);
+    }
+    else if (rit->second != ver)
+        _trdoomed = true;
+    auto it = itm->_iattrmap.find(attr);
+    if (it == itm->_iattrmap.end()) return nullptr;
+    return it->second;
+}
+
+void
+Transaction::put_attr(ItemPtr itp, ItemPtr attr, ValuePtr val)
+{
+    ItemVal*itm = itp.get();
+    if (!itm || !attr) return;
+    auto wit = _trwriteset.find(itm);
+    if (wit == _trwriteset.end()) {
+        _trkeep.push_back(itp);
+        wit = _trwriteset.emplace(itm,std::map<ItemPtr,ValuePtr>()).first;
+    }
+    wit->second[attr] = val;
+}
+
+bool
+Transaction::commit(void)
+{
+    if (_trdoomed) return false;
+    // lock every touched item, in address order to avoid deadlocks
+    std::set<ItemVal*> touched;
+    for (auto&r : _trreadset) touched.insert(r.first);
+    for (auto&w : _trwriteset) touched.insert(w.first);
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(touched.size());
+    for (ItemVal*itm : touched)
+        locks.emplace_back(itm->_imtx);
+    for (auto&r : _trreadset)
+        if (r.first->_iversion.load() != r.second) return false;
+    for (auto&w : _trwriteset) {
+        ItemVal*itm = w.first;
+        Pager::touch(itm);
+        for (auto&av : w.second) {
+            if (av.second) itm->_iattrmap[av.first] = av.second;
+            else itm->_iattrmap.erase(av.first);
+        }
+        Pager::reestimate(itm);
+        itm->_iversion++;
+    }
+    return true;
+}
+
+unsigned
+Transaction::run(std::function<void(Transaction&)> fun)
+{
+    for (unsigned cnt=1; ; cnt++) {
+        Transaction tr;
+        fun(tr);
+        if (tr.commit()) return cnt;
+        std::this_thread::yield();
+    }
+}
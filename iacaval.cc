@@ -115,6 +115,7 @@ bool ValuePtr::same(const ValuePtr vp1, const ValuePtr vp2)
 
 bool ValuePtr::less(const ValuePtr vp1, const ValuePtr vp2)
 {
+    IACA_TRACE_SCOPE("ValuePtr::less");
     const Value*valp1 = vp1.get();
     const Value*valp2 = vp2.get();
     if (valp1 == valp2) return false;
@@ -152,6 +153,7 @@ bool ValuePtr::less(const ValuePtr vp1, const ValuePtr vp2)
 const TupleVal*
 TupleVal::make_it(std::vector<ItemVal*>vecptr)
 {
+    IACA_TRACE_SCOPE("TupleVal::make");
     assert (std::all_of(vecptr.begin(),vecptr.end(),
     [](ItemVal*vptr) {
         return vptr!=nullptr;
@@ -162,6 +164,7 @@ TupleVal::make_it(std::vector<ItemVal*>vecptr)
 const TupleVal*
 TupleVal::make_it(ItemVal**arr, unsigned siz)
 {
+    IACA_TRACE_SCOPE("TupleVal::make");
     assert (std::all_of(arr,arr+siz,
     [](ItemVal*vptr) {
         return vptr!=nullptr;
@@ -269,6 +272,7 @@ TupleVal::make(const std::list<ValuePtr>&ilis)
 }
 
 Json::Value TupleVal::to_json(void) const {
+    IACA_TRACE_SCOPE("TupleVal::to_json");
     Json::Value j {Json::objectValue};
     Json::Value t {Json::arrayValue};
     for (unsigned ix=0; ix<_slen; ix++)
@@ -280,6 +284,7 @@ Json::Value TupleVal::to_json(void) const {
 
 
 Json::Value SetVal::to_json(void) const {
+    IACA_TRACE_SCOPE("SetVal::to_json");
     Json::Value j {Json::objectValue};
     Json::Value t {Json::arrayValue};
     for (unsigned ix=0; ix<_slen; ix++)
@@ -288,3 +293,155 @@ Json::Value SetVal::to_json(void) const {
     j["elem"] = t;
     return j;
 }
+
+const SetVal*
+SetVal::make_it(std::vector<ItemVal*>vecptr)
+{
+    IACA_TRACE_SCOPE("SetVal::make");
+    assert (std::all_of(vecptr.begin(),vecptr.end(),
+    [](ItemVal*vptr) {
+        return vptr!=nullptr;
+    }));
+    std::sort(vecptr.begin(),vecptr.end(),ItemVal::less);
+    auto endit = std::unique(vecptr.begin(),vecptr.end());
+    return new SetVal(vecptr.data(),endit-vecptr.begin());
+}
+
+// the std::set is already sorted and without duplicates
+const SetVal*
+SetVal::make_it(std::set<ItemPtr>iset)
+{
+    IACA_TRACE_SCOPE("SetVal::make");
+    std::vector<ItemVal*> vec;
+    vec.reserve(iset.size());
+    for (ItemPtr itp : iset)
+        if (itp) vec.push_back(itp.get());
+    return new SetVal(vec.data(),vec.size());
+}
+
+const SetVal*
+SetVal::make_it(ItemVal**arr, unsigned siz)
+{
+    return make_it(std::vector<ItemVal*>(arr,arr+siz));
+}
+
+const SetVal*
+SetVal::make(std::initializer_list<ItemPtr>il)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(il.size());
+    for (ItemPtr itp : il) {
+        TupleVal::add(vec,itp);
+    };
+    return make_it(vec);
+}
+
+const SetVal*
+SetVal::make(std::initializer_list<ValuePtr>il)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(il.size());
+    for (ValuePtr vp : il) {
+        TupleVal::add(vec,vp);
+    };
+    return make_it(vec);
+}
+
+const SetVal*
+SetVal::make(const std::vector<ItemPtr>&ivec)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(ivec.size());
+    for (ItemPtr itp : ivec) {
+        TupleVal::add(vec,itp);
+    };
+    return make_it(vec);
+}
+
+const SetVal*
+SetVal::make(const std::set<ItemPtr>&iset)
+{
+    return make_it(iset);
+}
+
+const SetVal*
+SetVal::make(const std::vector<ValuePtr>&ivec)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(ivec.size());
+    for (ValuePtr vp : ivec) {
+        TupleVal::add(vec,vp);
+    };
+    return make_it(vec);
+}
+
+const SetVal*
+SetVal::make(const std::list<ItemPtr>&ilis)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(ilis.size());
+    for (ItemPtr itp : ilis) {
+        TupleVal::add(vec,itp);
+    };
+    return make_it(vec);
+}
+
+const SetVal*
+SetVal::make(const std::list<ValuePtr>&ilis)
+{
+    std::vector<ItemVal*> vec;
+    vec.reserve(ilis.size());
+    for (ValuePtr vp : ilis) {
+        TupleVal::add(vec,vp);
+    };
+    return make_it(vec);
+}
+
+ItemPtr
+ItemPtr::from_json(const Json::Value&js)
+{
+    if (!js.isObject() || !js.isMember("item")) return nullptr;
+    QString radix = QString::fromStdString(js["item"].asString());
+    uint64_t rk = js.isMember("irank") ? js["irank"].asUInt64() : 0;
+    return ItemVal::find_or_make(radix,rk);
+}
+
+// the inverse of the to_json methods
+ValuePtr
+ValuePtr::from_json(const Json::Value&js)
+{
+    IACA_TRACE_SCOPE("ValuePtr::from_json");
+    switch (js.type()) {
+    case Json::nullValue:
+        return nullptr;
+    case Json::intValue:
+    case Json::uintValue:
+        return ValuePtr(new IntVal(js.asInt64()));
+    case Json::realValue:
+        return ValuePtr(new DblVal(js.asDouble()));
+    case Json::stringValue:
+        return ValuePtr(StrVal::make(js.asString()));
+    case Json::objectValue:
+        if (js.isMember("item"))
+            return ItemPtr::from_json(js);
+        else if (js["kind"].asString() == "tuple" || js["kind"].asString() == "set") {
+            bool istuple = js["kind"].asString() == "tuple";
+            std::vector<ItemPtr> vec;
+            const Json::Value&jcomp = js[istuple?"comp":"elem"];
+            vec.reserve(jcomp.size());
+            for (const Json::Value&jc : jcomp) {
+                ItemPtr itp = ItemPtr::from_json(jc);
+                if (!itp) throw std::runtime_error("bad item in JSON sequence");
+                vec.push_back(itp);
+            }
+            if (istuple)
+                return ValuePtr(const_cast<TupleVal*>(TupleVal::make(vec)));
+            else
+                return ValuePtr(const_cast<SetVal*>(SetVal::make(vec)));
+        }
+        break;
+    default:
+        break;
+    }
+    throw std::runtime_error("unexpected JSON for value");
+}